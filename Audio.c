@@ -0,0 +1,930 @@
+/*----------------------------------------------------------------------------
+ *      Name:    AUDIO.C
+ *      Purpose: Wave audio playback engine
+ *---------------------------------------------------------------------------*/
+
+#include <RTL.h>                      /* RTL kernel functions & defines      */
+#include <stdio.h>                    /* standard I/O .h-file                */
+#include <string.h>                   /* string and memory functions         */
+#include <LPC23xx.H>
+#include "Audio.h"
+
+struct audioData curAudio;
+
+/* One DAC input value (16 bit, offset binary) from a sample frame at 'bp' */
+#define SMP_MONO8(bp)     ((bp)[0] << 8)
+#define SMP_STEREO8(bp)   (((bp)[0] + (bp)[1]) << 7)
+#define SMP_MONO16(bp)    ((((bp)[1] << 8) + (bp)[0]) ^ 0x8000)
+#define SMP_STEREO16(bp)  ((SMP_MONO16(bp) + SMP_MONO16((bp) + 2)) >> 1)
+
+#if AUD_PROFILE
+ #define PROF_DECL        U32 prof_t0 = T1TC;
+ #define PROF_ADD         curAudio.ring.prof_ticks += T1TC - prof_t0;
+ #define PROF_END         PROF_ADD curAudio.ring.prof_cnt++;
+ #define PROF_CVT(n)      curAudio.ring.cvt_ticks += T1TC - prof_t0; \
+                          curAudio.ring.cvt_cnt   += (n);
+#else
+ #define PROF_DECL
+ #define PROF_ADD
+ #define PROF_END
+ #define PROF_CVT(n)
+#endif
+
+/* PCM to DAC word kernel, 'cnt' frames from 'src' to 'dst', volume 'sh'.
+   'src' may overlap the end of 'dst', see aud_ring_get. It need not be word
+   aligned: the ARM7 rotates the data of an unaligned LDR, so the kernels
+   go sample by sample up to the first word boundary.                      */
+typedef void (*AUD_CVT) (U32 *dst, const U8 *src, U32 cnt, U32 sh);
+
+/* Local Function Prototypes */
+static void aud_format (void);
+static U8  *aud_pcm (U32 *size);
+static U32  rd_u16 (const U8 *p);
+static U32  rd_u32 (const U8 *p);
+static void cvt_mono8 (U32 *dst, const U8 *src, U32 cnt, U32 sh);
+static void cvt_stereo8 (U32 *dst, const U8 *src, U32 cnt, U32 sh);
+static void cvt_mono16 (U32 *dst, const U8 *src, U32 cnt, U32 sh);
+static void cvt_stereo16 (U32 *dst, const U8 *src, U32 cnt, U32 sh);
+#if AUD_PROFILE == 2
+static void cvt_generic (U32 *dst, const U8 *src, U32 cnt, U32 sh);
+#endif
+
+/* Kernels indexed by curAudio.md */
+static const AUD_CVT aud_cvt_tab[4] = {
+  cvt_mono8, cvt_stereo8, cvt_mono16, cvt_stereo16
+};
+
+static AUD_CVT aud_cvt;                 /* Kernel for the current file       */
+static U32     aud_frame;               /* Bytes per PCM frame               */
+static U32     aud_wpos;                /* Words in the ring head segment    */
+
+#if AUD_BLOCK_OUT
+/* DAC words for block output, kept in local SRAM for single cycle FIQ reads.
+   The FIQ plays one half while AUD_IRQHandler refills the other.          */
+static U32           aud_dac[AUD_OUT_WORDS];
+static U32 *volatile aud_rd;            /* Next word written to DACR (FIQ)   */
+static U32           aud_last;          /* Word repeated on underrun         */
+static volatile U32  aud_data;          /* Halves holding ring data, bit 0/1 */
+
+static void aud_fill (U32 h);
+#endif
+
+#if AUD_SRC
+#define SRC_TAPS        8               /* Filter taps, src_run() unrolls    */
+#define SRC_PH_BITS     6
+#define SRC_PHASES      (1 << SRC_PH_BITS)
+#define SRC_HIST        (SRC_TAPS - 1)
+
+/* Resampler input: history of the last SRC_HIST samples, followed by one
+   converted block. Samples are signed, kept in local SRAM with the
+   coefficients since the filter loop reads them for every output word. */
+static S32  src_buf[SRC_HIST + AUD_SEG_WORDS];
+static S16  src_coef[SRC_PHASES][SRC_TAPS];   /* Q15, per phase sum 1.0 */
+static U32  src_rate;                   /* Input rate src_coef is made for   */
+static BOOL src_on;                     /* Resampling the current file       */
+static U32  src_inc;                    /* Input step per output, 16.16      */
+static U32  src_acc;                    /* Position in src_buf, 16.16        */
+static U32  src_avail;                  /* Samples in src_buf                */
+static U32  src_wpos;                   /* Words in the ring head segment    */
+
+static S32  src_sin (S32 a);
+static void src_design (U32 rate);
+static void src_begin (void);
+static BOOL src_run (void);
+#endif
+
+/*----------------------------------------------------------------------------
+ *        Initialize the playback engine
+ *---------------------------------------------------------------------------*/
+void aud_init (void) {
+
+  /* Ethernet RAM is clocked only when the Ethernet block is powered. */
+  PCONP |= (1 << 30);
+
+  curAudio.ring.seg = (U32 *)AUD_RING_ADDR;
+  aud_ring_reset ();
+
+#if AUD_BLOCK_OUT
+  /* Software interrupt to refill a played half of the DAC buffer, above
+     the card interrupts so that a half is never late.                   */
+  aud_rd       = &aud_dac[0];
+  VICVectAddr1 = (unsigned long)AUD_IRQHandler;
+  VICVectCntl1 = 10;
+  VICIntEnable = (1 << AUD_OUT_VIC);
+#endif
+
+#if AUD_PROFILE
+  /* Timer1 free runs at PCLK as the time base for handler profiling. */
+  PCONP |= (1 << 2);
+  T1PR   = 0;
+  T1TCR  = 1;
+#endif
+}
+
+/*----------------------------------------------------------------------------
+ *        Little endian field access
+ *---------------------------------------------------------------------------*/
+static U32 rd_u16 (const U8 *p) {
+  return (p[0] | (p[1] << 8));
+}
+
+static U32 rd_u32 (const U8 *p) {
+  return (p[0] | (p[1] << 8) | (p[2] << 16) | ((U32)p[3] << 24));
+}
+
+/*----------------------------------------------------------------------------
+ *        Walk the RIFF chunks of a wave file and fill in 'fmt', the file
+ *        is left positioned at the first sample
+ *---------------------------------------------------------------------------*/
+U32 aud_parse (FILE *f, AUD_FMT *fmt) {
+  U8 *buf;
+  U32 base, len, pos, id, size;
+  BOOL have_fmt = __FALSE;
+
+  /* The header is read in one go, into Ethernet RAM to keep the buffer
+     off the user stack.                                                 */
+  buf  = (U8 *)AUD_HDR_ADDR;
+  base = 0;
+  len  = fread (buf, 1, AUD_HDR_SIZE, f);
+  if (len < 12 || memcmp (&buf[0], "RIFF", 4) || memcmp (&buf[8], "WAVE", 4)) {
+    return (AUD_WAV_NOT_RIFF);
+  }
+  memset (fmt, 0, sizeof (AUD_FMT));
+
+  pos = 12;
+  for (;;) {
+    if ((pos + 48 > base + len && len == AUD_HDR_SIZE) || pos + 8 > base + len) {
+      /* Chunk is not fully buffered, e.g. after a large LIST chunk. The
+         48 bytes cover a chunk header and an extensible 'fmt ' body.     */
+      if (fseek (f, pos, SEEK_SET) != 0) {
+        break;
+      }
+      base = pos;
+      len  = fread (buf, 1, AUD_HDR_SIZE, f);
+      if (len < 8) {
+        break;
+      }
+    }
+    id   = pos - base;
+    size = rd_u32 (&buf[id + 4]);
+
+    if (memcmp (&buf[id], "fmt ", 4) == 0) {
+      if (size < 16 || id + 8 + 16 > len) {
+        return (AUD_WAV_NO_FMT);
+      }
+      id += 8;
+      fmt->tag      = rd_u16 (&buf[id + 0]);
+      fmt->channels = rd_u16 (&buf[id + 2]);
+      fmt->rate     = rd_u32 (&buf[id + 4]);
+      fmt->align    = rd_u16 (&buf[id + 12]);
+      fmt->bits     = rd_u16 (&buf[id + 14]);
+      if (fmt->tag == 0xFFFE && size >= 40 && id + 40 <= len) {
+        /* WAVE_FORMAT_EXTENSIBLE, the SubFormat GUID starts with the tag. */
+        fmt->tag = rd_u16 (&buf[id + 24]);
+      }
+      if (fmt->channels) {
+        /* Container size, independent of wValidBitsPerSample. */
+        fmt->bits = (fmt->align / fmt->channels) * 8;
+      }
+      have_fmt = __TRUE;
+    }
+    else if (memcmp (&buf[id], "data", 4) == 0) {
+      if (!have_fmt) {
+        return (AUD_WAV_NO_FMT);
+      }
+      fmt->data_off = pos + 8;
+      fmt->data_len = size ? size : 0xFFFFFFFF;   /* 0: streamed, unknown   */
+      if (fseek (f, fmt->data_off, SEEK_SET) != 0) {
+        return (AUD_WAV_NO_DATA);
+      }
+      return (AUD_WAV_OK);
+    }
+    /* LIST, fact, cue, PAD, ... are skipped by their size. */
+    if (size > 0xFFFFFFFF - 9 - pos) {
+      break;                            /* corrupt size, past any file       */
+    }
+    pos += 8 + size + (size & 1);
+  }
+  return (have_fmt ? AUD_WAV_NO_DATA : AUD_WAV_NO_FMT);
+}
+
+/*----------------------------------------------------------------------------
+ *        Empty the ring buffer and set it up for the format in curAudio.md
+ *---------------------------------------------------------------------------*/
+void aud_ring_reset (void) {
+  AUD_RING *r = &curAudio.ring;
+
+  r->head       = 0;
+  r->tail       = 0;
+  r->pos        = 0;
+  r->underrun   = 0;
+  r->overrun    = 0;
+  r->clock      = 0;
+  r->drop       = 0;
+  r->mark       = 0;
+  r->seeks      = 0;
+  r->seek_max   = 0;
+  r->prof_ticks = 0;
+  r->prof_cnt   = 0;
+  r->cvt_ticks  = 0;
+  r->cvt_cnt    = 0;
+  aud_wpos      = 0;
+#if AUD_BLOCK_OUT
+  aud_data      = 0;
+#endif
+
+#if AUD_SRC
+  src_on = __FALSE;
+#endif
+  aud_format ();
+}
+
+/*----------------------------------------------------------------------------
+ *        Producer: continue with the next file in curAudio, the data queued
+ *        so far plays on. Returns __FALSE while the resampler still holds
+ *        data of the previous file and the ring has no room for it.
+ *---------------------------------------------------------------------------*/
+BOOL aud_ring_next (void) {
+#if AUD_SRC
+  if (src_on && !src_run ()) {
+    return (__FALSE);
+  }
+#endif
+  aud_format ();
+  return (__TRUE);
+}
+
+/*----------------------------------------------------------------------------
+ *        Set up the producer for the format in curAudio
+ *---------------------------------------------------------------------------*/
+static void aud_format (void) {
+
+  aud_cvt   = aud_cvt_tab[curAudio.md & 3];
+#if AUD_PROFILE == 2
+  aud_cvt   = cvt_generic;              /* reference, see AUD_PROFILE        */
+#endif
+  aud_frame = ((curAudio.md & 1) + 1) << ((curAudio.md >> 1) & 1);
+
+#if AUD_SRC
+  if (src_on) {
+    /* Already resampling: keep the history and the partly filled segment,
+       the new file joins the old one without a gap.                     */
+    if (src_rate != curAudio.sampleRate) {
+      src_design ((U32)curAudio.sampleRate);
+    }
+    src_inc = ((U32)curAudio.sampleRate << 16) / AUD_SRC_RATE;
+  }
+  else if (curAudio.sampleRate != AUD_SRC_RATE) {
+    src_begin ();
+    src_wpos = aud_wpos;                /* go on filling the head segment    */
+    aud_wpos = 0;
+  }
+#endif
+}
+
+/*----------------------------------------------------------------------------
+ *        Producer: get room for PCM data in the next free segment, NULL
+ *        when the ring is full. '*size' returns the room in bytes.
+ *---------------------------------------------------------------------------*/
+U8 *aud_ring_get (U32 *size) {
+  AUD_RING *r = &curAudio.ring;
+
+#if AUD_SRC
+  if (src_on) {
+    /* Resample what is left of the last block first. */
+    if (!src_run ()) {
+      return (NULL);
+    }
+    return (aud_pcm (size));
+  }
+#endif
+  if ((r->head - r->tail) >= AUD_SEG_CNT) {
+    return (NULL);
+  }
+  return (aud_pcm (size));
+}
+
+/*----------------------------------------------------------------------------
+ *        Room for PCM data, as aud_ring_get() hands it out
+ *---------------------------------------------------------------------------*/
+static U8 *aud_pcm (U32 *size) {
+  AUD_RING *r = &curAudio.ring;
+  U32 raw;
+
+#if AUD_SRC
+  if (src_on) {
+    raw   = AUD_SEG_WORDS * aud_frame;
+    *size = raw;
+    return ((U8 *)&src_buf[SRC_HIST + AUD_SEG_WORDS] - raw);
+  }
+#endif
+  /* PCM goes to the end of the segment, so that the conversion can run
+     in place front to back: a word is written only after every byte it
+     covers has been loaded. One frame never takes more than one word.   */
+  raw   = (AUD_SEG_WORDS - aud_wpos) * aud_frame;
+  *size = raw;
+  return ((U8 *)&r->seg[(r->head & (AUD_SEG_CNT - 1)) * AUD_SEG_WORDS] +
+          AUD_SEG_BYTES - raw);
+}
+
+/*----------------------------------------------------------------------------
+ *        Producer: convert 'len' bytes of PCM in the segment returned by
+ *        aud_ring_get() to DAC words and hand it over to the consumer
+ *---------------------------------------------------------------------------*/
+BOOL aud_ring_put (U32 len) {
+  U32 size;
+
+  return (aud_ring_cvt (aud_pcm (&size), len));
+}
+
+/*----------------------------------------------------------------------------
+ *        Producer: convert 'len' bytes of PCM at 'src' to DAC words, into
+ *        the room aud_ring_get() found. 'src' is that room or a buffer of
+ *        its own, at any address. A segment goes to the consumer when it is
+ *        full, aud_ring_flush() hands over the last one.
+ *---------------------------------------------------------------------------*/
+BOOL aud_ring_cvt (const U8 *src, U32 len) {
+  AUD_RING *r = &curAudio.ring;
+  U32 *seg, cnt;
+  PROF_DECL
+
+#if AUD_SRC
+  if (src_on) {
+    /* Append the block to the history, signed, then filter it. */
+    seg = (U32 *)&src_buf[src_avail];
+    cnt = len / aud_frame;
+    aud_cvt (seg, src, cnt, 0);
+    for (len = 0; len < cnt; len++) {
+      src_buf[src_avail + len] = (S32)seg[len] - 0x8000;
+    }
+    src_avail += cnt;
+    src_run ();
+    return (__TRUE);
+  }
+#endif
+  if ((r->head - r->tail) >= AUD_SEG_CNT) {
+    r->overrun++;
+    return (__FALSE);
+  }
+  seg = &r->seg[(r->head & (AUD_SEG_CNT - 1)) * AUD_SEG_WORDS];
+  cnt = len / aud_frame;
+  aud_cvt (seg + aud_wpos, src, cnt, 7 - curAudio.vol);
+  PROF_CVT (cnt)
+  aud_wpos += cnt;
+  if (aud_wpos == AUD_SEG_WORDS) {
+    r->len[r->head & (AUD_SEG_CNT - 1)] = aud_wpos;
+    r->head++;                        /* publish after the length is valid  */
+    aud_wpos = 0;
+  }
+  return (__TRUE);
+}
+
+/*----------------------------------------------------------------------------
+ *        Producer: at end of file, push out data still held back by the
+ *        resampler. Returns __FALSE while the ring has no room for it.
+ *---------------------------------------------------------------------------*/
+BOOL aud_ring_flush (void) {
+  AUD_RING *r = &curAudio.ring;
+
+#if AUD_SRC
+  if (src_on) {
+    if (!src_run ()) {
+      return (__FALSE);
+    }
+    if (src_wpos) {
+      /* The partial head segment was reserved when it was started. */
+      r->len[r->head & (AUD_SEG_CNT - 1)] = src_wpos;
+      r->head++;
+      src_wpos = 0;
+    }
+  }
+#endif
+  if (aud_wpos) {
+    r->len[r->head & (AUD_SEG_CNT - 1)] = aud_wpos;
+    r->head++;
+    aud_wpos = 0;
+  }
+  return (__TRUE);
+}
+
+/*----------------------------------------------------------------------------
+ *        Check if all committed segments have been played
+ *---------------------------------------------------------------------------*/
+BOOL aud_ring_empty (void) {
+#if AUD_BLOCK_OUT
+  /* Data copied to the DAC buffer has yet to play. */
+  return (curAudio.ring.head == curAudio.ring.tail && aud_data == 0);
+#else
+  return (curAudio.ring.head == curAudio.ring.tail);
+#endif
+}
+
+/*----------------------------------------------------------------------------
+ *        Frames of the current file read into the engine but not played
+ *        yet. Approximate by a few samples, the consumer moves on meanwhile.
+ *---------------------------------------------------------------------------*/
+U32 aud_ring_queued (void) {
+  AUD_RING *r = &curAudio.ring;
+  U32 i, n, t;
+
+  t = r->tail;
+  for (n = 0, i = t; i != r->head; i++) {
+    n += r->len[i & (AUD_SEG_CNT - 1)];
+  }
+  n -= (n > r->pos) ? r->pos : n;
+  n += aud_wpos;
+#if AUD_BLOCK_OUT
+  /* Rest of the half playing and the half filled behind it. */
+  n += AUD_OUT_WORDS - (U32)(aud_rd - &aud_dac[0]) % AUD_OUT_HALF;
+#endif
+#if AUD_SRC
+  if (src_on) {
+    /* Output words back to input frames, plus input the filter holds
+       ahead of the sample in the middle of its taps.                    */
+    n = (U32)(((U64)(n + src_wpos) * src_inc) >> 16);
+    i = (src_acc >> 16) + SRC_TAPS / 2 - 1;
+    if (src_avail > i) {
+      n += src_avail - i;
+    }
+  }
+#endif
+  return (n);
+}
+
+/*----------------------------------------------------------------------------
+ *        Producer: discard everything queued, for a seek. 'mark' is the
+ *        clock of the request, the consumer times it to the next sample.
+ *---------------------------------------------------------------------------*/
+void aud_ring_drop (U32 mark) {
+  AUD_RING *r = &curAudio.ring;
+
+  /* 'tail' and 'pos' belong to the consumer, it empties the ring at its
+     next sample. While output is paused the producer does it itself.    */
+  r->drop = 1;
+  while (r->drop && (VICIntEnable & (1 << 4)));
+  if (r->drop) {
+    r->tail = r->head;
+    r->pos  = 0;
+    r->drop = 0;
+  }
+  aud_wpos = 0;
+#if AUD_SRC
+  if (src_on) {
+    src_begin ();                       /* restart from silence, same filter */
+  }
+#endif
+  r->mark = mark;
+}
+
+/*----------------------------------------------------------------------------
+ *        Output rate used for a file with sample rate 'rate'
+ *---------------------------------------------------------------------------*/
+U32 aud_out_rate (U32 rate) {
+#if AUD_SRC
+  return (AUD_SRC_RATE);
+#else
+  return (rate);
+#endif
+}
+
+/*----------------------------------------------------------------------------
+ *        Start sample output at 'rate' Hz, the ring must be primed
+ *---------------------------------------------------------------------------*/
+void aud_start (U32 rate) {
+
+  /* Timer0 runs at PCLK = 12.0 MHz. */
+  T0MR0 = (12000000 / aud_out_rate (rate)) - 1;
+
+#if AUD_BLOCK_OUT
+  /* Fill both halves ahead, then let the FIQ walk through them. */
+  aud_last = 0x8000 >> (7 - curAudio.vol);
+  aud_fill (0);
+  aud_fill (1);
+  aud_rd   = &aud_dac[0];
+  VICIntSelect |= (1 << 4);           /* Timer0 is serviced as FIQ          */
+#endif
+
+  T0TCR = 1;                          /* Timer0 Enable                      */
+  VICIntEnable = (1 << 4);            /* Enable Timer0 Interrupt            */
+}
+
+/*----------------------------------------------------------------------------
+ *        Stop sample output
+ *---------------------------------------------------------------------------*/
+void aud_stop (void) {
+
+  VICIntEnClr = (1 << 4);
+  T0TCR = 0;
+  VICIntSelect &= ~(1 << 4);
+#if AUD_BLOCK_OUT
+  VICSoftIntClear = (1 << AUD_OUT_VIC);
+#endif
+}
+
+/*----------------------------------------------------------------------------
+ *        Close the current file and stop playback
+ *---------------------------------------------------------------------------*/
+void clearAudData(){
+
+    if (curAudio.f != NULL) {
+      fclose(curAudio.f);
+      curAudio.f = NULL;
+    }
+    curAudio.curPos = 0;
+    curAudio.md = 0;
+    curAudio.readSize = 0;
+    curAudio.numChannels = 0;
+    curAudio.sampleRate = 0;
+    curAudio.sampleSize = 0;
+    curAudio.PCM = 0;
+
+    curAudio.eof = 0;
+    curAudio.vol = 0;
+    curAudio.ct = 0;
+
+    //curAudio.stat = 0;
+
+    aud_stop();
+}
+
+/*----------------------------------------------------------------------------
+ *        PCM to DAC word kernels. Each 32 bit load carries several
+ *        samples, which are split, sign flipped and mixed in registers.
+ *        Frames before the first word boundary are converted one by one.
+ *        A source that never reaches one, at an odd address or a stereo
+ *        16 bit frame off by a halfword, is converted one by one through.
+ *---------------------------------------------------------------------------*/
+static void cvt_mono8 (U32 *dst, const U8 *src, U32 cnt, U32 sh) {
+  const U32 *sp;
+  U32 w;
+
+  for (  ; cnt && ((unsigned long)src & 3); cnt--, src += 1) {
+    *dst++ = SMP_MONO8 (src) >> sh;
+  }
+  for (sp = (const U32 *)src; cnt >= 4; cnt -= 4, dst += 4) {
+    w = *sp++;                          /* 4 samples                         */
+    dst[0] = ((w <<  8) & 0xFF00) >> sh;
+    dst[1] = ( w        & 0xFF00) >> sh;
+    dst[2] = ((w >>  8) & 0xFF00) >> sh;
+    dst[3] = ((w >> 16) & 0xFF00) >> sh;
+  }
+  for (src = (const U8 *)sp; cnt; cnt--, src += 1) {
+    *dst++ = SMP_MONO8 (src) >> sh;
+  }
+}
+
+static void cvt_stereo8 (U32 *dst, const U8 *src, U32 cnt, U32 sh) {
+  const U32 *sp;
+  U32 w;
+
+  for (  ; cnt && ((unsigned long)src & 3); cnt--, src += 2) {
+    *dst++ = SMP_STEREO8 (src) >> sh;
+  }
+  for (sp = (const U32 *)src; cnt >= 2; cnt -= 2, dst += 2) {
+    w = *sp++;                          /* 2 frames, L+R summed per halfword */
+    w = (w & 0x00FF00FF) + ((w >> 8) & 0x00FF00FF);
+    dst[0] = ((w & 0xFFFF) << 7) >> sh;
+    dst[1] = ((w >> 16)    << 7) >> sh;
+  }
+  for (src = (const U8 *)sp; cnt; cnt--, src += 2) {
+    *dst++ = SMP_STEREO8 (src) >> sh;
+  }
+}
+
+static void cvt_mono16 (U32 *dst, const U8 *src, U32 cnt, U32 sh) {
+  const U32 *sp;
+  U32 w;
+
+  for (  ; cnt && ((unsigned long)src & 3); cnt--, src += 2) {
+    *dst++ = SMP_MONO16 (src) >> sh;
+  }
+  for (sp = (const U32 *)src; cnt >= 2; cnt -= 2, dst += 2) {
+    w = *sp++ ^ 0x80008000;             /* 2 samples to offset binary        */
+    dst[0] = (w & 0xFFFF) >> sh;
+    dst[1] = (w >> 16)    >> sh;
+  }
+  for (src = (const U8 *)sp; cnt; cnt--, src += 2) {
+    *dst++ = SMP_MONO16 (src) >> sh;
+  }
+}
+
+static void cvt_stereo16 (U32 *dst, const U8 *src, U32 cnt, U32 sh) {
+  const U32 *sp;
+  U32 w;
+
+  for (  ; cnt && ((unsigned long)src & 3); cnt--, src += 4) {
+    *dst++ = SMP_STEREO16 (src) >> sh;
+  }
+  for (sp = (const U32 *)src; cnt; cnt--) {
+    w = *sp++ ^ 0x80008000;             /* L and R to offset binary          */
+    *dst++ = (((w & 0xFFFF) + (w >> 16)) >> 1) >> sh;
+  }
+}
+
+#if AUD_PROFILE == 2
+/*----------------------------------------------------------------------------
+ *        Reference for the kernels above: one format test per sample
+ *---------------------------------------------------------------------------*/
+static void cvt_generic (U32 *dst, const U8 *src, U32 cnt, U32 sh) {
+  U32 temp;
+
+  for (  ; cnt; cnt--) {
+    switch (curAudio.md) {
+      case 0:
+        temp = SMP_MONO8 (src);
+        src += 1;
+        break;
+      case 1:
+        temp = SMP_STEREO8 (src);
+        src += 2;
+        break;
+      case 2:
+        temp = SMP_MONO16 (src);
+        src += 2;
+        break;
+      default:
+        temp = SMP_STEREO16 (src);
+        src += 4;
+        break;
+    }
+    *dst++ = temp >> sh;
+  }
+}
+#endif
+
+#if AUD_SRC
+/*----------------------------------------------------------------------------
+ *        sin (a * pi / 2^20) in Q30, Taylor series to x^9 after folding
+ *        the angle into -pi/2 .. pi/2. Good to a few 1e-6, plenty for the
+ *        Q15 filter taps.
+ *---------------------------------------------------------------------------*/
+static S32 src_sin (S32 a) {
+  S64 x, x2, s;
+
+  a = (S32)((U32)a << 11) >> 11;        /* -pi .. pi                         */
+  if (a > (1 << 19)) {
+    a = (1 << 20) - a;
+  } else if (a < -(1 << 19)) {
+    a = -(1 << 20) - a;
+  }
+  x  = ((S64)a * 3373259426u) >> 20;    /* radians, Q30 (pi in Q30)          */
+  x2 = (x * x) >> 30;
+  s  = ((S64)1 << 30) - x2 / 72;
+  s  = ((S64)1 << 30) - ((x2 * s) >> 30) / 42;
+  s  = ((S64)1 << 30) - ((x2 * s) >> 30) / 20;
+  s  = ((S64)1 << 30) - ((x2 * s) >> 30) / 6;
+  return ((S32)((x * s) >> 30));
+}
+
+/*----------------------------------------------------------------------------
+ *        Design the polyphase filter for input 'rate': Hann windowed sinc,
+ *        cut off below the lower of both Nyquist frequencies. Integer only,
+ *        the ARM7 has no FPU and this keeps soft-float libm out.
+ *---------------------------------------------------------------------------*/
+static void src_design (U32 rate) {
+  S64 h[SRC_TAPS], sum, g, v;
+  S32 fc, t, w;
+  int ph, k;
+
+  /* Cut off in Q16 of the input Nyquist frequency, with a transition
+     band for 8 taps.                                                    */
+  fc = (rate > AUD_SRC_RATE) ? (S32)(((U64)AUD_SRC_RATE * 58982) / rate) : 58982;
+
+  for (ph = 0; ph < SRC_PHASES; ph++) {
+    sum = 0;
+    for (k = 0; k < SRC_TAPS; k++) {
+      /* Distance of tap 'k' from the output point, in 1/64 samples. The
+         sinc is left scaled by pi, which the normalization below takes
+         out again.                                                      */
+      t = k * SRC_PHASES - (SRC_TAPS / 2 - 1) * SRC_PHASES - ph;
+      if (t == 0) {
+        g = ((S64)fc * 3373259426u) >> 16;
+      } else {
+        g = (S64)src_sin (fc * t / 4) * SRC_PHASES / t;
+      }
+      w = (S32)((((S64)1 << 30) + src_sin (t * 4096 + (1 << 19))) / 2);
+      h[k] = (g * w) >> 30;
+      sum += h[k];
+    }
+    for (k = 0; k < SRC_TAPS; k++) {
+      /* Unity gain in every phase, or the phase steps show up as noise. */
+      v = h[k] * 65536 + sum;
+      v = (v >= 0) ? v / (2 * sum) : -((-v + 2 * sum - 1) / (2 * sum));
+      src_coef[ph][k] = (v > 32767) ? 32767 : (S16)v;
+    }
+  }
+  src_rate = rate;
+}
+
+/*----------------------------------------------------------------------------
+ *        Start resampling curAudio.sampleRate to AUD_SRC_RATE
+ *---------------------------------------------------------------------------*/
+static void src_begin (void) {
+
+  if (src_rate != curAudio.sampleRate) {
+    src_design ((U32)curAudio.sampleRate);
+  }
+  /* Start with silence so that the first output lines up with the
+     first input sample in the middle of the filter.                    */
+  src_avail = SRC_TAPS / 2 - 1;
+  memset (src_buf, 0, src_avail * sizeof (S32));
+  src_inc   = ((U32)curAudio.sampleRate << 16) / AUD_SRC_RATE;
+  src_acc   = 0;
+  src_wpos  = 0;
+  src_on    = __TRUE;
+}
+
+/*----------------------------------------------------------------------------
+ *        Resample src_buf into the ring until the input runs short.
+ *        Returns __FALSE when the ring filled up with input left over.
+ *---------------------------------------------------------------------------*/
+static BOOL src_run (void) {
+  AUD_RING *r = &curAudio.ring;
+  const S32 *x;
+  const S16 *c;
+  U32 *seg, pos, sh;
+  S32 sum;
+
+  sh  = 7 - curAudio.vol;
+  seg = &r->seg[(r->head & (AUD_SEG_CNT - 1)) * AUD_SEG_WORDS];
+  for (;;) {
+    pos = src_acc >> 16;
+    if (pos + SRC_TAPS > src_avail) {
+      break;
+    }
+    if (src_wpos == 0 && (r->head - r->tail) >= AUD_SEG_CNT) {
+      return (__FALSE);                 /* start a segment only with room    */
+    }
+    x = &src_buf[pos];
+    c = src_coef[(src_acc >> (16 - SRC_PH_BITS)) & (SRC_PHASES - 1)];
+    sum = x[0] * c[0] + x[1] * c[1] + x[2] * c[2] + x[3] * c[3] +
+          x[4] * c[4] + x[5] * c[5] + x[6] * c[6] + x[7] * c[7];
+    sum = (sum >> 15) + 0x8000;
+    if (sum < 0)      sum = 0;
+    if (sum > 0xFFFF) sum = 0xFFFF;
+    seg[src_wpos] = (U32)sum >> sh;
+    src_acc += src_inc;
+
+    if (++src_wpos == AUD_SEG_WORDS) {
+      r->len[r->head & (AUD_SEG_CNT - 1)] = AUD_SEG_WORDS;
+      r->head++;
+      src_wpos = 0;
+      seg = &r->seg[(r->head & (AUD_SEG_CNT - 1)) * AUD_SEG_WORDS];
+    }
+  }
+  /* Keep the samples the next output still needs as history. */
+  pos = src_acc >> 16;
+  memmove (&src_buf[0], &src_buf[pos], (src_avail - pos) * sizeof (S32));
+  src_avail -= pos;
+  src_acc   -= pos << 16;
+  return (__TRUE);
+}
+#endif
+
+/*----------------------------------------------------------------------------
+ *        Sample output: write the next DAC word from the ring
+ *---------------------------------------------------------------------------*/
+static __inline void aud_out (void) {
+  AUD_RING *r = &curAudio.ring;
+  U32 idx;
+
+  r->clock++;
+  if (r->drop) {
+    r->tail = r->head;                  /* seek: discard all queued data     */
+    r->pos  = 0;
+    r->drop = 0;
+  }
+  idx = r->tail & (AUD_SEG_CNT - 1);
+  if (r->tail != r->head) {
+    if (r->mark) {
+      /* First sample after a seek, time it from the request. */
+      if (r->clock - r->mark > r->seek_max) {
+        r->seek_max = r->clock - r->mark;
+      }
+      r->seeks++;
+      r->mark = 0;
+    }
+    DACR = r->seg[idx * AUD_SEG_WORDS + r->pos];
+    if (++r->pos >= r->len[idx]) {
+      r->pos = 0;                       /* segment played, release it        */
+      r->tail++;
+    }
+  }
+  else if (!curAudio.eof) {
+    r->underrun++;                      /* ring is empty, DAC holds its value*/
+  }
+}
+
+/*----------------------------------------------------------------------------
+ *        Timer0 interrupt: output one sample
+ *---------------------------------------------------------------------------*/
+__irq void T0_IRQHandler (void) {
+  PROF_DECL
+
+  aud_out ();
+  T0IR        = 1;                    /* Clear MR0 interrupt flag           */
+  VICVectAddr = 0;                    /* Acknowledge Interrupt              */
+  PROF_END
+}
+
+#if AUD_BLOCK_OUT
+/*----------------------------------------------------------------------------
+ *        Copy DAC words from the ring to half 'h' of the DAC buffer, which
+ *        plays one half after the ring clock. An empty ring holds the last
+ *        value.
+ *---------------------------------------------------------------------------*/
+static void aud_fill (U32 h) {
+  AUD_RING *r = &curAudio.ring;
+  U32 *dst, cnt, idx, n, k;
+
+  dst = &aud_dac[h * AUD_OUT_HALF];
+  cnt = AUD_OUT_HALF;
+  aud_data &= ~(1 << h);
+
+  if (r->drop) {
+    r->tail = r->head;                  /* seek: discard all queued data     */
+    r->pos  = 0;
+    r->drop = 0;
+  }
+  for (k = 0; k < cnt; k += n) {
+    if (r->tail == r->head) {
+      if (!curAudio.eof) {
+        r->underrun += cnt - k;         /* ring is empty, DAC holds its value*/
+      }
+      for (  ; k < cnt; k++) {
+        dst[k] = aud_last;
+      }
+      return;
+    }
+    aud_data |= (1 << h);
+    if (r->mark) {
+      /* First sample after a seek, time it from the request. */
+      n = r->clock + AUD_OUT_HALF + k - r->mark;
+      if (n > r->seek_max) {
+        r->seek_max = n;
+      }
+      r->seeks++;
+      r->mark = 0;
+    }
+    idx = r->tail & (AUD_SEG_CNT - 1);
+    n   = r->len[idx] - r->pos;
+    if (n > cnt - k) {
+      n = cnt - k;
+    }
+    memcpy (&dst[k], &r->seg[idx * AUD_SEG_WORDS + r->pos], n * 4);
+    aud_last = dst[k + n - 1];
+    r->pos  += n;
+    if (r->pos >= r->len[idx]) {
+      r->pos = 0;                       /* segment played, release it        */
+      r->tail++;
+    }
+  }
+}
+#endif
+
+/*----------------------------------------------------------------------------
+ *        Timer0 fast interrupt: write one DAC word from the double buffer
+ *---------------------------------------------------------------------------*/
+__irq void FIQ_Handler (void) {
+#if AUD_BLOCK_OUT
+  U32 *rd;
+  PROF_DECL
+
+  rd   = aud_rd;
+  DACR = *rd++;
+  if (rd == &aud_dac[AUD_OUT_WORDS]) {
+    rd = &aud_dac[0];
+  }
+  if (rd == &aud_dac[0] || rd == &aud_dac[AUD_OUT_HALF]) {
+    /* Crossed into the other half, request a refill of the played one. */
+    VICSoftInt = (1 << AUD_OUT_VIC);
+  }
+  aud_rd = rd;
+#else
+  PROF_DECL
+
+  aud_out ();
+#endif
+  T0IR = 1;                           /* Clear MR0 interrupt flag           */
+  PROF_END
+}
+
+#if AUD_BLOCK_OUT
+/*----------------------------------------------------------------------------
+ *        Half buffer interrupt: refill the half the FIQ has left. The ring
+ *        bookkeeping runs here once per half, not once per sample.
+ *---------------------------------------------------------------------------*/
+__irq void AUD_IRQHandler (void) {
+  PROF_DECL
+
+  VICSoftIntClear = (1 << AUD_OUT_VIC);
+  curAudio.ring.clock += AUD_OUT_HALF;  /* the half just played            */
+  aud_fill ((aud_rd >= &aud_dac[AUD_OUT_HALF]) ? 0 : 1);
+  PROF_ADD
+  VICVectAddr = 0;                    /* Acknowledge Interrupt              */
+}
+#endif
+
+/*----------------------------------------------------------------------------
+ * end of file
+ *---------------------------------------------------------------------------*/
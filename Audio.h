@@ -0,0 +1,132 @@
+/*----------------------------------------------------------------------------
+ *      Name:    AUDIO.H
+ *      Purpose: Wave audio playback engine definitions
+ *---------------------------------------------------------------------------*/
+
+#ifndef __AUDIO_H
+#define __AUDIO_H
+
+/* Playback ring buffer, located in Ethernet RAM (AHB2, DMA capable). It
+   holds ready-to-write DACR words, converted from PCM in the foreground.   */
+#define AUD_RING_ADDR   0x7FE00000      /* Ring buffer base address          */
+#define AUD_SEG_WORDS   256             /* DAC words (samples) per segment   */
+#define AUD_SEG_CNT     8               /* Number of segments, power of 2    */
+#define AUD_SEG_BYTES   (AUD_SEG_WORDS * 4)
+
+/* Wave header buffer, behind the ring. The next track of a playlist is
+   parsed while the ring still plays the current one.                    */
+#define AUD_HDR_ADDR    (AUD_RING_ADDR + AUD_SEG_CNT * AUD_SEG_BYTES)
+#define AUD_HDR_SIZE    512             /* Header read, one card sector      */
+
+/* Output engine: 0 = Timer0 vectored IRQ (T0_IRQHandler), one word from
+                      the ring per sample,
+                  1 = Timer0 FIQ (FIQ_Handler) writes words from a double
+                      buffer, AUD_IRQHandler refills the half it has left
+                      from the ring, once per AUD_OUT_HALF samples. The
+                      ring clock then also moves on in halves.             */
+#define AUD_BLOCK_OUT   1
+#define AUD_OUT_WORDS   512             /* DAC buffer size, two halves       */
+#define AUD_OUT_HALF    (AUD_OUT_WORDS / 2)
+#define AUD_OUT_VIC     1               /* VIC channel for the half IRQ      */
+
+/* Sample rate conversion: 1 = resample every file to AUD_SRC_RATE with a
+   polyphase FIR, so Timer0 always runs at the same rate. 12 MHz divides
+   evenly by AUD_SRC_RATE. Files already at that rate bypass the filter.
+   0 = Timer0 follows each file's rate, nothing is resampled; files above
+   AUD_SRC_RATE would lose their top octave to the filter otherwise.      */
+#define AUD_SRC         0
+#define AUD_SRC_RATE    32000           /* DAC output rate [Hz]              */
+
+/* 1 = time the sample handlers and the PCM kernels with Timer1 (PCLK, 4 CPU
+   cycles per tick) and print the average cost per sample after playback.
+   2 = the same, but every format goes through cvt_generic(), the switch
+   per sample the kernels replaced, to compare the two on the target.      */
+#define AUD_PROFILE     0
+
+/* Single producer (cmd_play) / single consumer (output handler) ring.
+   'head' and 'tail' are free running segment counters, the ring is empty
+   when they are equal and full when they differ by AUD_SEG_CNT.            */
+typedef struct aud_ring {
+  U32          *seg;                    /* Segment storage                   */
+  volatile U16  len[AUD_SEG_CNT];       /* Valid words in each segment       */
+  volatile U32  head;                   /* Next segment to fill  (producer)  */
+  volatile U32  tail;                   /* Segment being played  (consumer)  */
+  U32           pos;                    /* Word offset in tail segment       */
+  volatile U32  underrun;               /* Samples due with the ring empty   */
+  volatile U32  overrun;                /* Segments offered with ring full   */
+  volatile U32  clock;                  /* Sample periods since the reset    */
+  volatile U32  drop;                   /* Producer asks to empty the ring   */
+  volatile U32  mark;                   /* Clock at a seek request, 0 = none */
+  volatile U32  seeks;                  /* Seeks heard at the DAC            */
+  volatile U32  seek_max;               /* Longest request to sound [clock]  */
+  volatile U32  prof_ticks;             /* Timer1 ticks spent in handlers    */
+  volatile U32  prof_cnt;               /* Handler invocations timed         */
+  U32           cvt_ticks;              /* Timer1 ticks spent in PCM kernels */
+  U32           cvt_cnt;                /* Samples converted while timed     */
+} AUD_RING;
+
+/* Wave file format, as found by aud_parse(). */
+typedef struct aud_fmt {
+  U32 data_off;                         /* File offset of the first sample   */
+  U32 data_len;                         /* Bytes of sample data              */
+  U32 rate;                             /* Samples per second                */
+  U16 tag;                              /* 1 = PCM, also for EXTENSIBLE      */
+  U16 channels;
+  U16 bits;                             /* Container bits per sample         */
+  U16 align;                            /* Bytes per sample frame            */
+} AUD_FMT;
+
+/* aud_parse() return codes */
+#define AUD_WAV_OK      0
+#define AUD_WAV_NOT_RIFF 1              /* No RIFF/WAVE header               */
+#define AUD_WAV_NO_FMT  2               /* 'fmt ' chunk missing or short     */
+#define AUD_WAV_NO_DATA 3               /* 'data' chunk not found            */
+
+/* Audio File being read */
+struct audioData {
+  U64 readSize;
+  long int numChannels;
+  long long int sampleRate;
+  long int sampleSize;
+  long int PCM;
+  long long int curPos;
+  U32 dataOffset;
+  U32 seekAt;
+  FILE * f;
+  char md;
+  AUD_RING ring;
+  int eof;
+  int vol;
+  int ct;
+
+  int stat;
+};
+
+extern struct audioData curAudio;
+
+/* Audio engine functions */
+extern void aud_init (void);
+extern U32  aud_parse (FILE *f, AUD_FMT *fmt);
+extern void aud_ring_reset (void);
+extern BOOL aud_ring_next (void);
+extern U8  *aud_ring_get (U32 *size);
+extern BOOL aud_ring_put (U32 len);
+extern BOOL aud_ring_cvt (const U8 *src, U32 len);
+extern BOOL aud_ring_flush (void);
+extern BOOL aud_ring_empty (void);
+extern U32  aud_ring_queued (void);
+extern void aud_ring_drop (U32 mark);
+extern U32  aud_out_rate (U32 rate);
+extern void aud_start (U32 rate);
+extern void aud_stop (void);
+extern void clearAudData (void);
+
+extern __irq void T0_IRQHandler (void);
+extern __irq void FIQ_Handler (void);
+extern __irq void AUD_IRQHandler (void);
+
+#endif
+
+/*----------------------------------------------------------------------------
+ * end of file
+ *---------------------------------------------------------------------------*/
@@ -0,0 +1,396 @@
+/*----------------------------------------------------------------------------
+ *      Name:    DIR.C
+ *      Purpose: Directory snapshot
+ *----------------------------------------------------------------------------
+ *      A directory is read once with ffind() into a packed entry array
+ *      and walked from RAM afterwards, filtered by the name part of the
+ *      mask and in any order. The snapshot is taken again when a sector
+ *      was written or another volume mounted since (blk_gen), or when a
+ *      walk asks for another directory.
+ *
+ *      A directory too large for the pool is walked in directory order
+ *      straight from ffind(). A sorted walk over it goes page by page:
+ *      each page is one ffind() pass that keeps the first entries after
+ *      the last page, so N entries take N / DIR_ENT_MAX passes or more.
+ *---------------------------------------------------------------------------*/
+
+#include <RTL.h>                      /* RTL kernel functions & defines      */
+#include <stdlib.h>                   /* qsort                               */
+#include <string.h>                   /* string and memory functions         */
+#include <ctype.h>                    /* character functions                 */
+#include <File_Config.h>
+#include "SD_Block.h"
+#include "Dir.h"
+
+/* Bytes an entry takes in the pool, entries stay word aligned */
+#define DIR_ENT_SIZE(n) ((sizeof (DIR_ENT) - 2 + (n) + 1 + 3) & ~3u)
+#define DIR_AT(w)       ((DIR_ENT *)&dir_pool[w])
+#define DIR_ENT_BIG     DIR_ENT_SIZE (255)
+
+static U32   dir_pool[DIR_POOL_SIZE / 4];
+static U16   dir_ord[DIR_ENT_MAX];      /* Pool word offsets in walk order   */
+static U32   dir_cnt;
+static U32   dir_key;                   /* Order of dir_ord, DIR_BY_xxx      */
+static U32   dir_gen;                   /* blk_gen at the snapshot           */
+static BOOL  dir_valid;
+static BOOL  dir_full;                  /* Too large, the pool is scratch    */
+static char  dir_path[DIR_PATH_LEN];    /* Directory part of the mask        */
+static FINFO dir_info;                  /* Kept off the 1 KB user stack      */
+
+/* Walk in progress */
+static const char *dir_mask;
+static const char *dir_pat;             /* Name part of dir_mask             */
+static BOOL  dir_all;                   /* dir_pat matches every name        */
+static BOOL  dir_stream;                /* Walk runs on ffind()              */
+static U32   dir_pos;
+
+/* Paged walk */
+static BOOL  dir_paged;                 /* Sorted walk runs page by page     */
+static BOOL  dir_more;                  /* Entries left for a later page     */
+static BOOL  dir_first;                 /* First page, dir_last not set      */
+static U32   dir_used;                  /* Pool bytes taken, holes included  */
+static U32   dir_live;                  /* Pool bytes of entries in dir_ord  */
+static U32   dir_last[DIR_ENT_BIG / 4]; /* Last entry of the page before     */
+static U32   dir_cand[DIR_ENT_BIG / 4]; /* Entry offered to the page         */
+
+/* Local Function Prototypes */
+static void dir_put (DIR_ENT *e, FINFO *info);
+static void dir_fill (void);
+static int  dir_ncmp (const char *a, const char *b);
+static int  dir_ecmp (const DIR_ENT *x, const DIR_ENT *y);
+static int  dir_cmp (const void *a, const void *b);
+static void dir_sort (U32 order);
+static BOOL dir_match (const char *m, const char *n);
+static void dir_heap_up (U32 i);
+static void dir_heap_down (U32 i);
+static void dir_pack (void);
+static void dir_page (void);
+
+/*----------------------------------------------------------------------------
+ *        Pack a search result into an entry
+ *---------------------------------------------------------------------------*/
+static void dir_put (DIR_ENT *e, FINFO *info) {
+  RL_TIME *t = &info->time;
+
+  e->size   = info->size;
+  e->time   = ((U32)(t->year - 1980) << 25) | ((U32)t->mon << 21) |
+              ((U32)t->day << 16) | ((U32)t->hr << 11) |
+              ((U32)t->min << 5) | (t->sec >> 1);
+  e->attrib = info->attrib;
+  e->len    = strlen ((const char *)info->name);
+  memcpy (e->name, info->name, e->len + 1);
+}
+
+/*----------------------------------------------------------------------------
+ *        Read directory 'dir_path' into the pool, in directory order
+ *---------------------------------------------------------------------------*/
+static void dir_fill (void) {
+  char mask[DIR_PATH_LEN + 4];
+  U32 used, sz;
+
+  dir_gen   = blk_gen;
+  dir_valid = __TRUE;
+  dir_full  = __FALSE;
+  dir_key   = DIR_BY_DIR;
+  dir_cnt   = 0;
+  used      = 0;
+  strcpy (mask, dir_path);
+  strcat (mask, "*.*");
+  dir_info.fileID = 0;
+  while (ffind (mask, &dir_info) == 0) {
+    sz = DIR_ENT_SIZE (strlen ((const char *)dir_info.name));
+    if (dir_cnt == DIR_ENT_MAX || used + sz > DIR_POOL_SIZE) {
+      dir_full = __TRUE;
+      break;
+    }
+    dir_put (DIR_AT (used / 4), &dir_info);
+    dir_ord[dir_cnt++] = used / 4;
+    used += sz;
+  }
+}
+
+/*----------------------------------------------------------------------------
+ *        Compare names the way FAT does, ignoring case
+ *---------------------------------------------------------------------------*/
+static int dir_ncmp (const char *a, const char *b) {
+
+  while (*a && toupper (*a) == toupper (*b)) {
+    a++;
+    b++;
+  }
+  return (toupper (*a) - toupper (*b));
+}
+
+/*----------------------------------------------------------------------------
+ *        Compare two entries for dir_key, equal keys go by name. Names are
+ *        unique in a directory, so no two entries compare equal.
+ *---------------------------------------------------------------------------*/
+static int dir_ecmp (const DIR_ENT *x, const DIR_ENT *y) {
+
+  if (dir_key == DIR_BY_SIZE && x->size != y->size) {
+    return ((x->size < y->size) ? -1 : 1);
+  }
+  if (dir_key == DIR_BY_TIME && x->time != y->time) {
+    return ((x->time < y->time) ? -1 : 1);
+  }
+  return (dir_ncmp (x->name, y->name));
+}
+
+/*----------------------------------------------------------------------------
+ *        qsort() comparison of two dir_ord items
+ *---------------------------------------------------------------------------*/
+static int dir_cmp (const void *a, const void *b) {
+  return (dir_ecmp (DIR_AT (*(const U16 *)a), DIR_AT (*(const U16 *)b)));
+}
+
+/*----------------------------------------------------------------------------
+ *        Put the snapshot in 'order'
+ *---------------------------------------------------------------------------*/
+static void dir_sort (U32 order) {
+  U32 i, w;
+
+  dir_key = order;
+  if (order != DIR_BY_DIR) {
+    qsort (dir_ord, dir_cnt, sizeof (dir_ord[0]), dir_cmp);
+    return;
+  }
+  /* The pool holds the entries in directory order. */
+  for (i = w = 0; i < dir_cnt; i++) {
+    dir_ord[i] = w;
+    w += DIR_ENT_SIZE (DIR_AT (w)->len) / 4;
+  }
+}
+
+/*----------------------------------------------------------------------------
+ *        Match a name against a mask with '*' and '?', ignoring case
+ *---------------------------------------------------------------------------*/
+static BOOL dir_match (const char *m, const char *n) {
+
+  for ( ; *m; m++, n++) {
+    if (*m == '*') {
+      while (*++m == '*');
+      if (*m == 0) {
+        return (__TRUE);
+      }
+      for ( ; *n; n++) {
+        if (dir_match (m, n)) {
+          return (__TRUE);
+        }
+      }
+      return (__FALSE);
+    }
+    if (*n == 0 || (*m != '?' && toupper (*m) != toupper (*n))) {
+      return (__FALSE);
+    }
+  }
+  return (*n == 0);
+}
+
+/*----------------------------------------------------------------------------
+ *        Max-heap on dir_ord[0 .. dir_cnt - 1]: move item 'i' up or down
+ *        to its place. dir_ord[0] is the last entry of the page.
+ *---------------------------------------------------------------------------*/
+static void dir_heap_up (U32 i) {
+  U16 t;
+
+  while (i && dir_cmp (&dir_ord[i], &dir_ord[(i - 1) / 2]) > 0) {
+    t = dir_ord[i];
+    dir_ord[i] = dir_ord[(i - 1) / 2];
+    dir_ord[(i - 1) / 2] = t;
+    i = (i - 1) / 2;
+  }
+}
+
+static void dir_heap_down (U32 i) {
+  U32 k;
+  U16 t;
+
+  while ((k = 2 * i + 1) < dir_cnt) {
+    if (k + 1 < dir_cnt && dir_cmp (&dir_ord[k + 1], &dir_ord[k]) > 0) {
+      k++;
+    }
+    if (dir_cmp (&dir_ord[k], &dir_ord[i]) <= 0) {
+      break;
+    }
+    t = dir_ord[i];
+    dir_ord[i] = dir_ord[k];
+    dir_ord[k] = t;
+    i = k;
+  }
+}
+
+/*----------------------------------------------------------------------------
+ *        Close the holes displaced entries left in the pool and build the
+ *        heap again. A displaced entry is marked by an empty name.
+ *---------------------------------------------------------------------------*/
+static void dir_pack (void) {
+  DIR_ENT *e;
+  U32 w, to, sz;
+
+  dir_cnt = 0;
+  for (w = to = 0; w < dir_used; w += sz) {
+    e  = DIR_AT (w / 4);
+    sz = DIR_ENT_SIZE (e->len);
+    if (e->name[0]) {
+      memmove (DIR_AT (to / 4), e, sz);
+      dir_ord[dir_cnt++] = to / 4;
+      to += sz;
+    }
+  }
+  dir_used = to;
+  for (w = dir_cnt / 2; w; w--) {
+    dir_heap_down (w - 1);
+  }
+}
+
+/*----------------------------------------------------------------------------
+ *        Read the next page of a paged walk: the first entries in dir_key
+ *        order that match the mask and follow dir_last, as many as the
+ *        pool takes. The pass keeps them in a max-heap, an entry before
+ *        the largest one displaces it. Once an entry is left for a later
+ *        page, nothing after the largest is taken even where there is
+ *        room, or the next page would start behind that entry. The page
+ *        is sorted at the end.
+ *---------------------------------------------------------------------------*/
+static void dir_page (void) {
+  char mask[DIR_PATH_LEN + 4];
+  DIR_ENT *c = (DIR_ENT *)dir_cand;
+  DIR_ENT *e;
+  U32 sz;
+
+  dir_cnt  = 0;
+  dir_pos  = 0;
+  dir_used = 0;
+  dir_live = 0;
+  dir_more = __FALSE;
+  strcpy (mask, dir_path);
+  strcat (mask, "*.*");
+  dir_info.fileID = 0;
+  while (ffind (mask, &dir_info) == 0) {
+    dir_put (c, &dir_info);
+    if (!(dir_all || dir_match (dir_pat, c->name)) ||
+        (!dir_first && dir_ecmp (c, (DIR_ENT *)dir_last) <= 0)) {
+      continue;
+    }
+    sz = DIR_ENT_SIZE (c->len);
+    if (dir_more && dir_ecmp (c, DIR_AT (dir_ord[0])) > 0) {
+      continue;                         /* for a later page                  */
+    }
+    while (dir_cnt == DIR_ENT_MAX || dir_used + sz > DIR_POOL_SIZE) {
+      if (dir_cnt < DIR_ENT_MAX && dir_live + sz <= DIR_POOL_SIZE) {
+        dir_pack ();
+        continue;
+      }
+      dir_more = __TRUE;
+      e = DIR_AT (dir_ord[0]);
+      if (dir_ecmp (c, e) > 0) {
+        sz = 0;                         /* for a later page                  */
+        break;
+      }
+      dir_live  -= DIR_ENT_SIZE (e->len);
+      e->name[0] = 0;
+      dir_ord[0] = dir_ord[--dir_cnt];
+      dir_heap_down (0);
+    }
+    if (sz) {
+      memcpy (DIR_AT (dir_used / 4), c, sz);
+      dir_ord[dir_cnt] = dir_used / 4;
+      dir_heap_up (dir_cnt++);
+      dir_used += sz;
+      dir_live += sz;
+    }
+  }
+  qsort (dir_ord, dir_cnt, sizeof (dir_ord[0]), dir_cmp);
+}
+
+/*----------------------------------------------------------------------------
+ *        Start a walk over the entries matching 'mask', which has to stay
+ *        valid until the walk ends. Returns __FALSE when the directory
+ *        path is too long for a snapshot and 'order' can not be applied;
+ *        the walk then runs in directory order.
+ *---------------------------------------------------------------------------*/
+BOOL dir_open (const char *mask, U32 order) {
+  const char *p;
+  U32 len;
+
+  dir_mask = mask;
+  dir_pat  = mask;
+  for (p = mask; *p; p++) {
+    if (*p == '\\' || *p == '/' || *p == ':') {
+      dir_pat = p + 1;
+    }
+  }
+  dir_all = (*dir_pat == 0 || strcmp (dir_pat, "*") == 0 ||
+             strcmp (dir_pat, "*.*") == 0);
+  dir_pos   = 0;
+  dir_paged = __FALSE;
+
+  len = dir_pat - mask;
+  if (len >= DIR_PATH_LEN) {
+    dir_valid  = __FALSE;               /* the pool serves as scratch        */
+    dir_stream = __TRUE;
+    dir_info.fileID = 0;
+    return (order == DIR_BY_DIR);
+  }
+  if (!dir_valid || dir_gen != blk_gen ||
+      strncmp (dir_path, mask, len) != 0 || dir_path[len] != 0) {
+    memcpy (dir_path, mask, len);
+    dir_path[len] = 0;
+    dir_fill ();
+  }
+  dir_stream = dir_full;
+  if (dir_stream && order != DIR_BY_DIR) {
+    dir_valid  = __FALSE;               /* the pool holds one page           */
+    dir_stream = __FALSE;
+    dir_paged  = __TRUE;
+    dir_first  = __TRUE;
+    dir_key    = order;
+    dir_page ();
+    return (__TRUE);
+  }
+  if (dir_stream) {
+    dir_info.fileID = 0;
+    return (__TRUE);
+  }
+  if (order != dir_key) {
+    dir_sort (order);
+  }
+  return (__TRUE);
+}
+
+/*----------------------------------------------------------------------------
+ *        Next entry of the walk, NULL at the end. The entry is valid until
+ *        the next call.
+ *---------------------------------------------------------------------------*/
+DIR_ENT *dir_next (void) {
+  DIR_ENT *e;
+
+  if (dir_stream) {
+    if (ffind (dir_mask, &dir_info) != 0) {
+      return (NULL);
+    }
+    e = DIR_AT (0);
+    dir_put (e, &dir_info);
+    return (e);
+  }
+  for (;;) {
+    while (dir_pos < dir_cnt) {
+      e = DIR_AT (dir_ord[dir_pos++]);
+      if (dir_all || dir_match (dir_pat, e->name)) {
+        return (e);
+      }
+    }
+    if (!dir_paged || !dir_more) {
+      return (NULL);
+    }
+    /* Page done, the next one starts behind its last entry. */
+    e = DIR_AT (dir_ord[dir_cnt - 1]);
+    memcpy (dir_last, e, DIR_ENT_SIZE (e->len));
+    dir_first = __FALSE;
+    dir_page ();
+  }
+}
+
+/*----------------------------------------------------------------------------
+ * end of file
+ *---------------------------------------------------------------------------*/
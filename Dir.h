@@ -0,0 +1,38 @@
+/*----------------------------------------------------------------------------
+ *      Name:    DIR.H
+ *      Purpose: Directory snapshot definitions
+ *---------------------------------------------------------------------------*/
+
+#ifndef __DIR_H
+#define __DIR_H
+
+/* Snapshot storage in local RAM. Entries are packed back to back. A
+   directory that does not fit is walked with ffind() on every listing,
+   sorted walks over it take one pass per page of the pool (see Dir.c). */
+#define DIR_POOL_SIZE   6144            /* Packed entry storage [bytes]      */
+#define DIR_ENT_MAX     384             /* Entries in one snapshot           */
+#define DIR_PATH_LEN    64              /* Longest directory part of a mask  */
+
+/* Walk orders */
+#define DIR_BY_DIR      0               /* Directory order                   */
+#define DIR_BY_NAME     1
+#define DIR_BY_SIZE     2
+#define DIR_BY_TIME     3
+
+/* Packed directory entry, 'name' runs past the end of the structure. */
+typedef struct dir_ent {
+  U32  size;
+  U32  time;                            /* Packed time stamp, FAT layout     */
+  U8   attrib;
+  U8   len;                             /* strlen (name)                     */
+  char name[2];
+} DIR_ENT;
+
+extern BOOL     dir_open (const char *mask, U32 order);
+extern DIR_ENT *dir_next (void);
+
+#endif
+
+/*----------------------------------------------------------------------------
+ * end of file
+ *---------------------------------------------------------------------------*/
@@ -392,6 +392,12 @@
 
 //------------- <<< end of configuration section >>> -----------------------
 
+/* Memory Card drive sector reads and writes pass the read-ahead layer */
+#include "SD_Block.h"
+#define mci_Init        blk_Init
+#define mci_ReadSector  blk_ReadSector
+#define mci_WriteSector blk_WriteSector
+
 #ifndef  __NO_FILE_LIB_C
 #include <File_lib.c>
 #endif
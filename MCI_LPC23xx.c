@@ -10,7 +10,7 @@
  *---------------------------------------------------------------------------*/
 
 #include <File_Config.h>
-#include <LPC23xx.h>                 /* LPC23xx/24xx definitions             */
+#include <LPC23xx.H>                 /* LPC23xx/24xx definitions             */
 #include "MCI_LPC23xx.h"
 
 /*----------------------------------------------------------------------------
@@ -20,7 +20,6 @@
  *---------------------------------------------------------------------------*/
 
 #define __DRV_ID  mci0_drv
-#define __MCLK    48000000
 #define __CPUCLK  48000000
 
 /* MCI Driver Interface functions */
@@ -53,8 +52,43 @@ MCI_DRV __DRV_ID = {
 /* Wait time in for loop cycles */
 #define DMA_TOUT  10000000
 
+/* Completion events, see WaitEvent() */
+#define MCI_EVT_DMA  0x01             /* GPDMA channel 0 terminal count      */
+#define MCI_EVT_MCI  0x02             /* A source enabled in MCI_MASK0 fired */
+
+/* Write path statistics */
+MCI_WR_STAT mci_wr_stat;
+
+/* Application work while waiting */
+void (*mci_idle) (void);
+
+/* Current bus clock */
+U32 mci_bus_khz;
+
+#if MCI_IRQ
+static volatile U32 mci_evt;
+
+/* Read request queue, 'rq_tail' is the request on the bus */
+static MCI_RQ      *rq_q[MCI_RQ_CNT];
+static volatile U32 rq_head;
+static volatile U32 rq_tail;
+static volatile U32 rq_phase;         /* 0 = idle, 1 = data, 2 = stop        */
+static BOOL         rq_err;
+static BOOL         mci_hc;           /* Card is block addressed (SDHC)      */
+#endif
+
 /* Local Functions */
-static void DmaStart (U32 mode, U8 *buf);
+static U32  MclkFreq (void);
+static void DmaStart (U32 mode, U8 *buf, U32 cnt);
+static BOOL WaitEvent (U32 evt);
+#if MCI_IRQ
+static void RqIdle (void);
+static void RqStart (void);
+static void RqStop (void);
+static void RqDone (void);
+static __irq void MCI_IRQHandler (void);
+static __irq void DMA_IRQHandler (void);
+#endif
 
 /*--------------------------- Init ------------------------------------------*/
 
@@ -78,6 +112,16 @@ static BOOL Init (void) {
   MCI_COMMAND   = 0;
   MCI_DATA_CTRL = 0;
   MCI_CLEAR     = 0x7FF;
+  MCI_MASK0     = 0;
+
+#if MCI_IRQ
+  /* Completion interrupts, above the button and A/D handlers. */
+  VICVectAddr24 = (unsigned long)MCI_IRQHandler;
+  VICVectCntl24 = 12;
+  VICVectAddr25 = (unsigned long)DMA_IRQHandler;
+  VICVectCntl25 = 11;
+  VICIntEnable  = (1 << 24) | (1 << 25);
+#endif
 
   /* Power up, switch on VCC for the Flash Card. */
   MCI_POWER  = 0x02;
@@ -98,6 +142,10 @@ static BOOL UnInit (void) {
   /* Power down, switch off VCC for the Flash Card. */
   MCI_POWER = 0x00;
 
+#if MCI_IRQ
+  VICIntEnClr = (1 << 24) | (1 << 25);
+#endif
+
   /* Clear all pending interrupts. */
   MCI_COMMAND   = 0;
   MCI_DATA_CTRL = 0;
@@ -166,23 +214,49 @@ static BOOL BusWidth (U32 width) {
 
 static BOOL BusSpeed (U32 kbaud) {
   /* Set a MCI clock speed to desired value. */
-  U32 div;
-
+  U32 mclk,div;
+
+  if (kbaud > SD_CLK/1000) kbaud = SD_CLK/1000;
+  mclk = MclkFreq () / 1000;
+  if (kbaud >= mclk) {
+    /* Bypass the divider, the bus runs at MCLK. */
+    MCI_CLOCK   = (MCI_CLOCK & ~0x4FF) | 0x700;
+    mci_bus_khz = mclk;
+    return (__TRUE);
+  }
   /* baud = MCLK / (2 x (div + 1)) */
-  div = (__MCLK/2000 + kbaud - 1) / kbaud;
+  div = (mclk/2 + kbaud - 1) / kbaud;
   if (div > 0)    div--;
   if (div > 0xFF) div = 0xFF;
-  MCI_CLOCK = (MCI_CLOCK & ~0xFF) | 0x300 | div;
+  MCI_CLOCK   = (MCI_CLOCK & ~0x4FF) | 0x300 | div;
+  mci_bus_khz = mclk / (2 * (div + 1));
   return (__TRUE);
 }
 
 
+/*--------------------------- MclkFreq --------------------------------------*/
+
+static U32 MclkFreq (void) {
+  /* MCI peripheral clock, as PCLKSEL1 divides the CPU clock. */
+
+  switch ((PCLKSEL1 >> 24) & 3) {
+    case 1:  return (__CPUCLK);
+    case 2:  return (__CPUCLK / 2);
+    case 3:  return (__CPUCLK / 8);
+  }
+  return (__CPUCLK / 4);
+}
+
+
 /*--------------------------- Command ---------------------------------------*/
 
 static BOOL Command (U8 cmd, U32 arg, U32 resp_type, U32 *rp) {
   /* Send a Command to Flash card and get a Response. */
   U32 cmdval,stat;
 
+#if MCI_IRQ
+  RqIdle ();
+#endif
   cmd   &= 0x3F;
   cmdval = 0x400 | cmd;
   switch (resp_type) {
@@ -194,6 +268,9 @@ static BOOL Command (U8 cmd, U32 arg, U32 resp_type, U32 *rp) {
       break;
   }
   /* Send the command. */
+#if MCI_IRQ
+  mci_evt      = 0;
+#endif
   MCI_ARGUMENT = arg;
   MCI_COMMAND  = cmdval;
 
@@ -204,14 +281,21 @@ static BOOL Command (U8 cmd, U32 arg, U32 resp_type, U32 *rp) {
     return (__TRUE);
   }
 
+  /* Sleep on the response, the loop below still polls if it never comes. */
+  MCI_MASK0 = MCI_CMD_TIMEOUT | MCI_CMD_CRC_FAIL | MCI_CMD_RESP_END;
+  WaitEvent (MCI_EVT_MCI);
+  MCI_MASK0 = 0;
+
+  /* Only the command flags are cleared, a data phase that mci_rd_data()
+     armed ahead of the command keeps its own.                          */
   for (;;) {
     stat = MCI_STATUS;
     if (stat & MCI_CMD_TIMEOUT) {
-      MCI_CLEAR = stat & MCI_CLEAR_MASK;
+      MCI_CLEAR = stat & MCI_CMD_CLR_MASK;
       return (__FALSE);
     }
     if (stat & MCI_CMD_CRC_FAIL) {
-      MCI_CLEAR = stat & MCI_CLEAR_MASK;
+      MCI_CLEAR = stat & MCI_CMD_CLR_MASK;
       if ((cmd == SEND_OP_COND)      ||
           (cmd == SEND_APP_OP_COND)  ||
           (cmd == STOP_TRANS)) {
@@ -221,7 +305,7 @@ static BOOL Command (U8 cmd, U32 arg, U32 resp_type, U32 *rp) {
       return (__FALSE);
     }
     if (stat & MCI_CMD_RESP_END) {
-      MCI_CLEAR = stat & MCI_CLEAR_MASK;
+      MCI_CLEAR = stat & MCI_CMD_CLR_MASK;
       break;
     }
   }
@@ -237,6 +321,12 @@ static BOOL Command (U8 cmd, U32 arg, U32 resp_type, U32 *rp) {
     rp[2] = MCI_RESP2;
     rp[3] = MCI_RESP3;
   }
+#if MCI_IRQ
+  if ((cmd == SEND_OP_COND || cmd == SEND_APP_OP_COND) && (rp[0] & 0x80000000)) {
+    /* OCR of a ready card, CCS tells the addressing of the read queue. */
+    mci_hc = (rp[0] & 0x40000000) != 0;
+  }
+#endif
   return (__TRUE);
 }
 
@@ -245,24 +335,28 @@ static BOOL Command (U8 cmd, U32 arg, U32 resp_type, U32 *rp) {
 
 static BOOL ReadBlock (U32 bl, U8 *buf, U32 cnt) {
   /* Read one or more 512 byte blocks from Flash Card. */
-  U32 i;
+  U32 n;
 
-  /* Set MCI Transfer registers. */
-  MCI_DATA_TMR  = DATA_RD_TOUT_VALUE;
-  MCI_DATA_LEN  = cnt * 512;
+#if MCI_IRQ
+  RqIdle ();
+#endif
+  for ( ; cnt; cnt -= n, buf += n * 512) {
+    n = (cnt > MCI_LLI_CNT) ? MCI_LLI_CNT : cnt;
 
-  /* Start DMA Peripheral to Memory transfer. */
-  DmaStart (DMA_READ, buf);
-  MCI_DATA_CTRL = 0x9B;
+    /* Set MCI Transfer registers. */
+    MCI_DATA_TMR  = DATA_RD_TOUT_VALUE;
+    MCI_DATA_LEN  = n * 512;
 
-  for (i = DMA_TOUT; i; i--) {
-    if (GPDMA_RAW_INT_TCSTAT & 0x01) {
-      /* Data transfer finished. */
-      return (__TRUE);
+    /* Start DMA Peripheral to Memory transfer. */
+    DmaStart (DMA_READ, buf, n);
+    MCI_DATA_CTRL = 0x9B;
+
+    if (!WaitEvent (MCI_EVT_DMA)) {
+      /* DMA Transfer timeout. */
+      return (__FALSE);
     }
   }
-  /* DMA Transfer timeout. */
-  return (__FALSE);
+  return (__TRUE);
 }
 
 
@@ -270,40 +364,53 @@ static BOOL ReadBlock (U32 bl, U8 *buf, U32 cnt) {
 
 static BOOL WriteBlock (U32 bl, U8 *buf, U32 cnt) {
   /* Write a cnt number of 512 byte blocks to Flash Card. */
-  U32 i,j;
+  U32 i,n,all = cnt;
+
+#if MCI_IRQ
+  RqIdle ();
+#endif
+  for ( ; cnt; cnt -= n, bl += n, buf += n * 512) {
+    /* One data phase streams up to MCI_LLI_CNT blocks, the DMA follows
+       its list from block to block without the CPU.                   */
+    n = (cnt > MCI_LLI_CNT) ? MCI_LLI_CNT : cnt;
 
-  for (j = 0; j < cnt; buf += 512, j++) {
     /* Set MCI Transfer registers. */
+    MCI_CLEAR     = MCI_DATA_END | MCI_DATA_BLK_END;
     MCI_DATA_TMR  = DATA_WR_TOUT_VALUE;
-    MCI_DATA_LEN  = 512;
+    MCI_DATA_LEN  = n * 512;
 
     /* Start DMA Memory to Peripheral transfer. */
-    DmaStart (DMA_WRITE, buf);
+    DmaStart (DMA_WRITE, buf, n);
     MCI_DATA_CTRL = 0x99;
+    mci_wr_stat.phases++;
 
-    for (i = DMA_TOUT; i; i--) {
-      if (GPDMA_RAW_INT_TCSTAT & 0x01) {
-        /* Data transfer finished. */
-        break;
-      }
-    }
-
-    if (i == 0) {
+    if (!WaitEvent (MCI_EVT_DMA)) {
       /* DMA Data Transfer timeout. */
+      mci_wr_stat.errors++;
+      mci_wr_stat.err_blk = bl + (n * 512 - MCI_DATA_CNT) / 512;
       return (__FALSE);
     }
 
-    if (cnt == 1) {
+    if (all == 1) {
+      mci_wr_stat.blocks++;
       break;
     }
 
-    /* Wait until Data Block sent to Card. */
-    while (MCI_STATUS != (MCI_DATA_END | MCI_DATA_BLK_END)) {
+    /* Wait until the last Data Block is sent to Card. MCI_DATA_CNT tells
+       which block of the list failed.                                  */
+    MCI_MASK0 = MCI_DATA_END | MCI_DATA_CRC_FAIL | MCI_DATA_TIMEOUT;
+    WaitEvent (MCI_EVT_MCI);
+    MCI_MASK0 = 0;
+    while (!(MCI_STATUS & MCI_DATA_END)) {
       if (MCI_STATUS & (MCI_DATA_CRC_FAIL | MCI_DATA_TIMEOUT)) {
         /* Error while Data Block sending occured. */
+        mci_wr_stat.errors++;
+        mci_wr_stat.err_blk = bl + (n * 512 - MCI_DATA_CNT) / 512;
         return (__FALSE);
       }
     }
+    mci_wr_stat.blocks += n;
+
     /* Wait 2 SD clocks */
     for (i = WAIT_2SD_CLK(__CPUCLK); i; i--);
   }
@@ -311,34 +418,293 @@ static BOOL WriteBlock (U32 bl, U8 *buf, U32 cnt) {
 }
 
 
+/*--------------------------- mci_rd_data -----------------------------------*/
+
+BOOL mci_rd_data (U8 cmd, U32 arg, U8 *buf, U32 len) {
+  /* Send a command that answers with one short data block and read the
+     block from the FIFO. 'len' is 8..64 bytes, a power of 2, the whole
+     block fits the FIFO and polling it can not overrun.                 */
+  U32 rp[4],stat,v,i,n;
+
+  /* The data path is armed before the command, as in RqStart(): the block
+     can follow the response before Command() returns.                   */
+#if MCI_IRQ
+  RqIdle ();
+#endif
+  for (n = 0; (1U << n) < len; n++);
+  MCI_CLEAR     = 0x7FF;
+  MCI_DATA_TMR  = DATA_RD_TOUT_VALUE;
+  MCI_DATA_LEN  = len;
+  MCI_DATA_CTRL = 0x03 | (n << 4);
+  if (!Command (cmd, arg, RESP_SHORT, rp)) {
+    MCI_DATA_CTRL = 0;
+    MCI_CLEAR     = 0x7FF;
+    return (__FALSE);
+  }
+
+  stat = 0;
+  for (i = 0, n = DMA_TOUT; n; n--) {
+    stat = MCI_STATUS;
+    if (stat & MCI_RX_DATA_AVAIL) {
+      v = MCI_FIFO;
+      if (i < len) {
+        buf[i]   = (U8)v;
+        buf[i+1] = (U8)(v >> 8);
+        buf[i+2] = (U8)(v >> 16);
+        buf[i+3] = (U8)(v >> 24);
+      }
+      i += 4;
+      continue;
+    }
+    if (stat & (MCI_DATA_TIMEOUT | MCI_DATA_CRC_FAIL | MCI_RX_OVERRUN |
+                MCI_START_BIT_ERR | MCI_DATA_BLK_END)) {
+      break;
+    }
+  }
+  MCI_DATA_CTRL = 0;
+  MCI_CLEAR     = 0x7FF;
+  if ((stat & MCI_DATA_BLK_END) == 0 || i < len) {
+    return (__FALSE);
+  }
+  return (__TRUE);
+}
+
+
 /*--------------------------- DmaStart --------------------------------------*/
 
-static void DmaStart (U32 mode, U8 *buf) {
-  /* Configure DMA for read or write. */
+static void DmaStart (U32 mode, U8 *buf, U32 cnt) {
+  /* Configure DMA for read or write of cnt blocks. */
+  U32 *lli = (U32 *)MCI_LLI_ADDR;
+  U32 ctrl,cfg,src,dst,i;
 
   if (mode == DMA_READ) {
     /* Transfer from MCI-FIFO to memory. */
-    GPDMA_CH0_SRC  = (U32)&MCI_FIFO;
-    GPDMA_CH0_DEST = (U32)buf;
+    src  = (unsigned long)&MCI_FIFO;
+    dst  = (unsigned long)buf;
     /* The burst size set to 8, transfer size 512 bytes. */
-    GPDMA_CH0_CTRL = (512 >> 2)   | (0x02 << 12) | (0x02 << 15) | 
-                     (0x02 << 18) | (0x02 << 21) | (1 << 27)    | (1u << 31);
-    GPDMA_CH0_CFG  = 0x10001 | (0x04 << 1) | (0x00 << 6) | (0x06 << 11);
+    ctrl = (512 >> 2)   | (0x02 << 12) | (0x02 << 15) |
+           (0x02 << 18) | (0x02 << 21) | (1 << 27);
+    cfg  = 0x10001 | (0x04 << 1) | (0x00 << 6) | (0x06 << 11);
   }
   else {
     /* Transfer from memory to MCI-FIFO. */
-    GPDMA_CH0_SRC  = (U32)buf;
-    GPDMA_CH0_DEST = (U32)&MCI_FIFO;
+    src  = (unsigned long)buf;
+    dst  = (unsigned long)&MCI_FIFO;
     /* The burst size set to 8, transfer size 512 bytes. */
-    GPDMA_CH0_CTRL = (512 >> 2)   | (0x02 << 12) | (0x02 << 15) |
-                     (0x02 << 18) | (0x02 << 21) | (1 << 26)    | (1u << 31);
-    GPDMA_CH0_CFG  = 0x10001 | (0x00 << 1) | (0x04 << 6) | (0x05 << 11);
+    ctrl = (512 >> 2)   | (0x02 << 12) | (0x02 << 15) |
+           (0x02 << 18) | (0x02 << 21) | (1 << 26);
+    cfg  = 0x10001 | (0x00 << 1) | (0x04 << 6) | (0x05 << 11);
+  }
+
+  /* Blocks 2..cnt follow as list items, only the last one raises the
+     terminal count. The first block is loaded into the channel.       */
+  for (i = 1; i < cnt; i++, lli += 4) {
+    buf   += 512;
+    lli[0] = (mode == DMA_READ) ? src : (unsigned long)buf;
+    lli[1] = (mode == DMA_READ) ? (unsigned long)buf : dst;
+    lli[2] = (i + 1 < cnt) ? (unsigned long)(lli + 4) : 0;
+    lli[3] = (i + 1 < cnt) ? ctrl : (ctrl | (1u << 31));
   }
+  GPDMA_CH0_SRC  = src;
+  GPDMA_CH0_DEST = dst;
+  GPDMA_CH0_LLI  = (cnt > 1) ? MCI_LLI_ADDR : 0;
+  GPDMA_CH0_CTRL = (cnt > 1) ? ctrl : (ctrl | (1u << 31));
+#if MCI_IRQ
+  cfg           |= (1 << 15);         /* Terminal count interrupt           */
+  mci_evt        = 0;
+#endif
+  GPDMA_CH0_CFG  = cfg;
+
   /* Enable DMA channels, little endian */
   GPDMA_INT_TCCLR = 0x01;
   GPDMA_CONFIG    = 0x01;
 }
 
+
+/*--------------------------- WaitEvent -------------------------------------*/
+
+static BOOL WaitEvent (U32 evt) {
+  /* Wait for a DMA or MCI completion, with a timeout in loop cycles. */
+  U32 i;
+
+  for (i = DMA_TOUT; i; i--) {
+#if MCI_IRQ
+    if (mci_evt & evt) {
+      return (__TRUE);
+    }
+    if (mci_idle != NULL) {
+      mci_idle ();
+    }
+#else
+    if ((evt & MCI_EVT_DMA) && (GPDMA_RAW_INT_TCSTAT & 0x01)) {
+      return (__TRUE);
+    }
+    if ((evt & MCI_EVT_MCI) && (MCI_STATUS & MCI_MASK0)) {
+      return (__TRUE);
+    }
+#endif
+  }
+  return (__FALSE);
+}
+
+
+#if MCI_IRQ
+/*--------------------------- mci_rd_submit ---------------------------------*/
+
+BOOL mci_rd_submit (MCI_RQ *rq) {
+  /* Queue an asynchronous read, it starts at once when the bus is free. */
+
+  if (rq->cnt == 0 || rq->cnt > MCI_LLI_CNT ||
+      (rq_head - rq_tail) >= MCI_RQ_CNT) {
+    return (__FALSE);
+  }
+  if ((MCI_POWER & 0x03) != 0x03) {
+    /* Card not powered up (never mounted or uninitialized). */
+    return (__FALSE);
+  }
+  rq->stat = MCI_RQ_QUEUED;
+
+  /* The handlers move the queue on, keep them out while it is changed. */
+  VICIntEnClr = (1 << 24) | (1 << 25);
+  rq_q[rq_head % MCI_RQ_CNT] = rq;
+  rq_head++;
+  if (rq_phase == 0) {
+    RqStart ();
+  }
+  VICIntEnable = (1 << 24) | (1 << 25);
+  return (__TRUE);
+}
+
+
+/*--------------------------- mci_rd_wait -----------------------------------*/
+
+BOOL mci_rd_wait (MCI_RQ *rq) {
+  /* Wait for a submitted read to finish. */
+
+  while (rq->stat == MCI_RQ_QUEUED || rq->stat == MCI_RQ_BUSY) {
+    if (mci_idle != NULL) {
+      mci_idle ();
+    }
+  }
+  return (rq->stat == MCI_RQ_DONE);
+}
+
+
+/*--------------------------- RqIdle ----------------------------------------*/
+
+static void RqIdle (void) {
+  /* A synchronous access waits until the queue has drained. */
+
+  while (rq_head != rq_tail) {
+    if (mci_idle != NULL) {
+      mci_idle ();
+    }
+  }
+}
+
+
+/*--------------------------- RqStart ---------------------------------------*/
+
+static void RqStart (void) {
+  /* Put the oldest queued request on the bus. The data path is armed
+     before the command, so the first block can not arrive too early. */
+  MCI_RQ *rq = rq_q[rq_tail % MCI_RQ_CNT];
+
+  rq->stat      = MCI_RQ_BUSY;
+  rq_err        = __FALSE;
+  rq_phase      = 1;
+  MCI_CLEAR     = 0x7FF;
+  MCI_DATA_TMR  = DATA_RD_TOUT_VALUE;
+  MCI_DATA_LEN  = rq->cnt * 512;
+  DmaStart (DMA_READ, rq->buf, rq->cnt);
+  MCI_DATA_CTRL = 0x9B;
+
+  /* Only errors interrupt, the end of data is the DMA terminal count. */
+  MCI_MASK0     = MCI_CMD_TIMEOUT | MCI_CMD_CRC_FAIL |
+                  MCI_DATA_TIMEOUT | MCI_DATA_CRC_FAIL | MCI_START_BIT_ERR;
+  MCI_ARGUMENT  = mci_hc ? rq->sect : rq->sect * 512;
+  MCI_COMMAND   = 0x400 | 0x40 | ((rq->cnt > 1) ? READ_MULT_BLOCK : READ_BLOCK);
+}
+
+
+/*--------------------------- RqStop ----------------------------------------*/
+
+static void RqStop (void) {
+  /* Data phase over, a multiple block read ends with STOP_TRANSMISSION. */
+
+  if (rq_q[rq_tail % MCI_RQ_CNT]->cnt == 1) {
+    RqDone ();
+    return;
+  }
+  rq_phase     = 2;
+  MCI_CLEAR    = 0x7FF;
+  MCI_MASK0    = MCI_CMD_TIMEOUT | MCI_CMD_CRC_FAIL | MCI_CMD_RESP_END;
+  MCI_ARGUMENT = 0;
+  MCI_COMMAND  = 0x400 | 0x40 | STOP_TRANS;
+}
+
+
+/*--------------------------- RqDone ----------------------------------------*/
+
+static void RqDone (void) {
+  /* Report the request and start the next one. */
+  MCI_RQ *rq = rq_q[rq_tail % MCI_RQ_CNT];
+
+  MCI_MASK0 = 0;
+  MCI_CLEAR = 0x7FF;
+  rq->stat  = rq_err ? MCI_RQ_ERROR : MCI_RQ_DONE;
+  rq_phase  = 0;
+  rq_tail++;
+  if (rq_tail != rq_head) {
+    RqStart ();
+  }
+}
+
+
+/*--------------------------- MCI_IRQHandler --------------------------------*/
+
+static __irq void MCI_IRQHandler (void) {
+
+  if (rq_phase == 1) {
+    /* Read request failed, stop the data path and end the transfer. */
+    MCI_DATA_CTRL = 0;
+    GPDMA_CH0_CFG = 0;
+    rq_err        = __TRUE;
+    RqStop ();
+  }
+  else if (rq_phase == 2) {
+    /* STOP_TRANSMISSION answered, a CRC error is normal for it. */
+    if (MCI_STATUS & MCI_CMD_TIMEOUT) {
+      rq_err = __TRUE;
+    }
+    RqDone ();
+  }
+  else {
+    /* Status flags stay set for the foreground, masking ends the request. */
+    MCI_MASK0 = 0;
+    mci_evt  |= MCI_EVT_MCI;
+  }
+  VICVectAddr = 0;
+}
+
+
+/*--------------------------- DMA_IRQHandler --------------------------------*/
+
+static __irq void DMA_IRQHandler (void) {
+  /* Channel 0 terminal count. */
+  if (GPDMA_INT_TCSTAT & 0x01) {
+    GPDMA_INT_TCCLR = 0x01;
+    if (rq_phase == 1) {
+      RqStop ();
+    }
+    else {
+      mci_evt |= MCI_EVT_DMA;
+    }
+  }
+  VICVectAddr = 0;
+}
+#endif
+
 /*--------------------------- CheckMedia ------------------------------------*/
 
 static U32 CheckMedia (void) {
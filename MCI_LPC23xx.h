@@ -12,7 +12,13 @@
 #ifndef __MCI_LPC23XX_H
 #define __MCI_LPC23XX_H
 
-/* SD Card communication speed */
+/* Transfer completion: 1 = MCI and GPDMA interrupts, the waiting
+   foreground runs mci_idle() meanwhile; 0 = poll the status registers.  */
+#define MCI_IRQ             1
+
+/* SD Card communication speed: the fastest bus clock the MCI may run,
+   bus tuning at mount stays at or below it. The timeouts below count
+   clocks of this rate, a slower bus only makes them last longer.        */
 #define SD_CLK              24000000
 
 /* Wait timeouts, in multiples of 6 byte send over MCI (for 1 bit mode)      */
@@ -48,6 +54,56 @@
 #define MCI_RX_DATA_AVAIL   0x00200000
 
 #define MCI_CLEAR_MASK      0x000007FF
+#define MCI_CMD_CLR_MASK    0x000000C5  /* Command flags only, see Command() */
+
+/* DMA linked list for multi-block transfers, one item per block. The GPDMA
+   reaches only the AHB RAMs, the list sits in USB RAM behind the MC0 cache.
+   MCI_DATA_LEN is 16 bits wide, a data phase carries at most 127 blocks.   */
+#define MCI_LLI_ADDR        0x7FD01400
+#define MCI_LLI_CNT         64                  /* Blocks per data phase     */
+
+/* Write path statistics */
+typedef struct {
+  U32 blocks;                           /* Blocks written                    */
+  U32 phases;                           /* Data phases (DMA lists) started   */
+  U32 errors;                           /* Failed data phases                */
+  U32 err_blk;                          /* Card block that failed last       */
+} MCI_WR_STAT;
+
+extern MCI_WR_STAT mci_wr_stat;
+
+/* Called while a command or transfer is in flight, NULL = spin. It must
+   not call the file system or submit reads. It runs once per pass of the
+   wait loops, whose timeouts count passes: keep it to a few cycles.      */
+extern void (*mci_idle) (void);
+
+/* Bus clock set by the last BusSpeed() call [kHz] */
+extern U32 mci_bus_khz;
+
+/* Short data block reads (SCR, SD status, switch function status) */
+extern BOOL mci_rd_data (U8 cmd, U32 arg, U8 *buf, U32 len);
+
+#if MCI_IRQ
+/* Asynchronous sector read, queued with mci_rd_submit() and carried out
+   by the MCI and GPDMA interrupts. 'buf' must be in USB or Ethernet RAM. */
+typedef struct mci_rq {
+  U32          sect;                    /* First card sector                 */
+  U8          *buf;
+  U32          cnt;                     /* Sectors, 1..MCI_LLI_CNT           */
+  volatile U32 stat;                    /* MCI_RQ_xxx                        */
+} MCI_RQ;
+
+#define MCI_RQ_IDLE         0
+#define MCI_RQ_QUEUED       1
+#define MCI_RQ_BUSY         2
+#define MCI_RQ_DONE         3
+#define MCI_RQ_ERROR        4
+
+#define MCI_RQ_CNT          4                   /* Requests in the queue     */
+
+extern BOOL mci_rd_submit (MCI_RQ *rq);
+extern BOOL mci_rd_wait (MCI_RQ *rq);
+#endif
 
 #endif
 
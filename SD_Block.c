@@ -0,0 +1,744 @@
+/*----------------------------------------------------------------------------
+ *      Name:    SD_BLOCK.C
+ *      Purpose: Sector layer between FlashFS and the MCI driver
+ *----------------------------------------------------------------------------
+ *      FlashFS reads a file through its cache one run of sectors at a time
+ *      and waits for every run. When reads turn out to be sequential, this
+ *      layer keeps the following sectors in flight on the asynchronous MCI
+ *      read queue, so the card works while the last run is consumed. A
+ *      later read of those sectors is copied from the read-ahead slot.
+ *
+ *      Sectors read out of sequence, FAT and directory sectors foremost,
+ *      are kept in a small sector cache. The FAT layout comes from the
+ *      boot sector as FlashFS reads it at mount: the FATs and the FAT12/16
+ *      root directory are a class of their own that other sectors never
+ *      displace. Other lines start on probation and are protected when
+ *      they are read again (segmented LRU). Writes go through the cache.
+ *
+ *      Free space is counted by ffree() once per volume and then kept up
+ *      to date from the FAT sectors written: a written FAT16/32 sector is
+ *      compared with its cached old copy, entries that turned used or free
+ *      move the count. FAT12, or an old copy not in the cache, brings back
+ *      the count by ffree() at the next query.
+ *
+ *      At mount the SD bus is tuned: 4-bit mode and the high speed
+ *      function are taken where the card offers them, and the bus runs
+ *      at the fastest clock that still reads the same data as 400 kHz.
+ *      FlashFS mounts again before every console command, so the result
+ *      is kept: while the card answers with the same SCR and size, the
+ *      settings are only applied again. A failed mount, as with the card
+ *      pulled, has the next card tuned.
+ *---------------------------------------------------------------------------*/
+
+#include <RTL.h>                      /* RTL kernel functions & defines      */
+#include <string.h>                   /* string and memory functions         */
+#include <File_Config.h>
+#include <LPC23xx.H>
+#include "MCI_LPC23xx.h"
+#include "SD_Block.h"
+
+/* SD commands beyond those in File_Config.h */
+#define SWITCH_FUNC     6
+#define SD_STATUS       13              /* ACMD                              */
+#define SET_WR_BLK_ERASE_COUNT 23       /* ACMD                              */
+#define SEND_SCR        51              /* ACMD                              */
+
+/* Bus tuning: sectors compared at each clock and read for the rate */
+#define BLK_TUNE_SECTS  4
+#define BLK_TUNE_KB     64
+
+/* Cache line classes, in the order lines are given up */
+#define BLK_FREE        0
+#define BLK_PROB        1               /* Data, read once                   */
+#define BLK_PROT        2               /* Data, read again                  */
+#define BLK_META        3               /* FAT or FAT12/16 root directory    */
+
+#if BLK_CACHE_ADDR
+ #if BLK_CACHE_ADDR < 0x7FD00000 || \
+     BLK_CACHE_ADDR + BLK_CACHE_SECTS * 512 > BLK_USB_RAM_END
+  #error "BLK_CACHE_SECTS: the sector cache does not fit into USB RAM"
+ #endif
+ #define BLK_LINE_BUF(lp)  ((U8 *)BLK_CACHE_ADDR + ((lp) - blk_line) * 512)
+#else
+ #define BLK_LINE_BUF(lp)  ((U8 *)blk_cbuf[(lp) - blk_line])
+#endif
+
+BLK_STAT  blk_stat;
+BLK_CSTAT blk_cstat;
+BLK_BUS   blk_bus;
+U32       blk_spc;
+U32       blk_gen;
+
+/* Sector cache line */
+typedef struct blk_line {
+  U32 sect;
+  U32 used;                             /* blk_tick at the last access       */
+  U32 cls;                              /* BLK_xxx                           */
+} BLK_LINE;
+
+static BLK_LINE blk_line[BLK_CACHE_SECTS];
+#if !BLK_CACHE_ADDR
+static U32      blk_cbuf[BLK_CACHE_SECTS][128];   /* Line data, words    */
+#endif
+static U32      blk_tick;
+static U32      blk_vol;                /* Volume boot sector, from the MBR  */
+static U32      blk_fat;                /* First FAT sector, ~0 = unknown    */
+static U32      blk_root;               /* End of the FATs and root dir      */
+static U32      blk_vsn;                /* Volume serial number              */
+static U32      blk_fsz;                /* Sectors per FAT                   */
+static U32      blk_fbits;              /* FAT entry width, 12, 16 or 32     */
+static U32      blk_fcl = 0xFFFFFFFF;   /* Free clusters, ~0 = not counted   */
+static U32      blk_end[2];             /* End of the last two reads         */
+static BOOL     blk_tuned;              /* blk_bus holds a tuning result     */
+static U8       blk_scr[8];             /* SCR of the card tuned for         */
+
+#if MCI_IRQ
+/* Read-ahead slot, 'valid' while it holds or awaits sectors not read yet */
+typedef struct blk_slot {
+  MCI_RQ rq;
+  BOOL   valid;
+} BLK_SLOT;
+
+static BLK_SLOT blk_slot[BLK_RA_SLOTS];
+static U32      blk_next;               /* Next sector to read ahead         */
+#endif
+static U32      blk_cnt;                /* Sectors on the card               */
+
+/* Local Function Prototypes */
+static void blk_tune (MCI_DEV *mci);
+static BOOL blk_retune (MCI_DEV *mci);
+static BOOL blk_same (MCI_DEV *mci, U8 *ref, U8 *tst);
+static BOOL blk_app (MCI_DEV *mci);
+static U32  blk_class (U32 sect, BOOL seq);
+static BLK_LINE *blk_lookup (U32 sect);
+static BOOL blk_get (U32 sect, U8 *buf, U32 cnt);
+static void blk_put (U32 sect, const U8 *buf, U32 cnt, U32 cls);
+static void blk_touch (BLK_LINE *lp);
+static BLK_LINE *blk_victim (U32 cls);
+static void blk_forget (U32 sect, U32 cnt);
+static void blk_boot (U32 sect, const U8 *p);
+static void blk_fat_upd (U32 sect, const U8 *buf, U32 cnt);
+#if MCI_IRQ
+static BLK_SLOT *blk_find (U32 sect);
+static void blk_ahead (U32 from);
+static void blk_drop (U32 sect, U32 cnt);
+#endif
+
+/*----------------------------------------------------------------------------
+ *        Initialize the card, tune the bus and forget all read-ahead state.
+ *        The bus tuning and the sector cache are kept while the card stays
+ *        the same size, and the cache while the boot sector read at mount
+ *        stays the same.
+ *---------------------------------------------------------------------------*/
+BOOL blk_Init (U32 mode, MCI_DEV *mci) {
+  Media_INFO info;
+  U32 cnt;
+  BOOL kept;
+#if MCI_IRQ
+  U32 i;
+#endif
+
+  /* Ethernet RAM is clocked only when the Ethernet block is powered. */
+  PCONP |= (1 << 30);
+
+#if MCI_IRQ
+  for (i = 0; i < BLK_RA_SLOTS; i++) {
+    if (blk_slot[i].valid) {
+      mci_rd_wait (&blk_slot[i].rq);
+      blk_slot[i].valid = __FALSE;
+    }
+    blk_slot[i].rq.buf = (U8 *)BLK_RA_ADDR + i * BLK_RA_SECTS * 512;
+  }
+  blk_next   = 0;
+#endif
+  blk_end[0] = 0xFFFFFFFF;
+  blk_end[1] = 0xFFFFFFFF;
+  cnt        = blk_cnt;
+  blk_cnt    = 0;
+  if (!mci_Init (mode, mci)) {
+    blk_forget (0, 0xFFFFFFFF);
+    blk_tuned = __FALSE;                /* card gone, tune the next one      */
+    return (__FALSE);
+  }
+  kept = blk_tuned && blk_retune (mci);
+  if (!kept) {
+    blk_tune (mci);
+  }
+  if (mci_ReadInfo (&info, mci)) {
+    blk_cnt = info.block_cnt;
+  }
+  if (blk_cnt != cnt || blk_cnt == 0) {
+    blk_forget (0, 0xFFFFFFFF);         /* another card                      */
+    if (kept) {
+      blk_tune (mci);                   /* of the same kind                  */
+    }
+  }
+  return (__TRUE);
+}
+
+/*----------------------------------------------------------------------------
+ *        Read sectors, from the sector cache or the read-ahead slots where
+ *        they are found
+ *---------------------------------------------------------------------------*/
+BOOL blk_ReadSector (U32 sect, U8 *buf, U32 cnt, MCI_DEV *mci) {
+#if MCI_IRQ
+  BLK_SLOT *sp;
+  U32 done, off, n;
+#endif
+  U32 cls;
+  BOOL seq;
+
+  /* Sequential: continues one of the last two reads (file data runs are
+     often split by a FAT sector read), or was read ahead.             */
+  seq = (sect == blk_end[0] || sect == blk_end[1]);
+  blk_end[1] = blk_end[0];
+  blk_end[0] = sect + cnt;
+
+  cls = blk_class (sect, seq);
+  if (blk_get (sect, buf, cnt)) {
+    blk_cstat.hits[sect >= blk_fat && sect < blk_root] += cnt;
+    return (__TRUE);
+  }
+  if (cls != BLK_FREE) {
+    blk_cstat.misses[cls == BLK_META] += cnt;
+  }
+
+#if MCI_IRQ
+  for (done = 0; done < cnt; done += n) {
+    if ((sp = blk_find (sect + done)) == NULL) {
+      break;
+    }
+    if (!mci_rd_wait (&sp->rq)) {
+      sp->valid = __FALSE;              /* read failed, ask the card again   */
+      break;
+    }
+    off = sect + done - sp->rq.sect;
+    n   = sp->rq.cnt - off;
+    if (n > cnt - done) {
+      n = cnt - done;
+    }
+    memcpy (buf + done * 512, sp->rq.buf + off * 512, n * 512);
+    if (off + n == sp->rq.cnt) {
+      sp->valid = __FALSE;              /* all used, free for the next run   */
+    }
+    blk_stat.hits += n;
+    seq = __TRUE;
+  }
+  if (done < cnt) {
+    blk_stat.misses += cnt - done;
+    if (!mci_ReadSector (sect + done, buf + done * 512, cnt - done, mci)) {
+      return (__FALSE);
+    }
+  }
+  if (seq) {
+    blk_ahead (sect + cnt);
+  }
+#else
+  blk_stat.misses += cnt;
+  if (!mci_ReadSector (sect, buf, cnt, mci)) {
+    return (__FALSE);
+  }
+#endif
+  if (sect < blk_fat) {
+    blk_boot (sect, buf);               /* MBR or reserved sectors           */
+  }
+  else {
+    blk_put (sect, buf, cnt, cls);
+  }
+  return (__TRUE);
+}
+
+/*----------------------------------------------------------------------------
+ *        Write sectors, read-ahead copies of them become stale and cached
+ *        ones take the new data. Written FAT sectors are cached.
+ *---------------------------------------------------------------------------*/
+BOOL blk_WriteSector (U32 sect, U8 *buf, U32 cnt, MCI_DEV *mci) {
+#if BLK_PRE_ERASE
+  U32 r[4];
+#endif
+
+  blk_gen++;
+#if MCI_IRQ
+  blk_drop (sect, cnt);
+#endif
+#if BLK_PRE_ERASE
+  /* The erase count holds for the next write command only. MMC cards
+     have no SCR, blk_bus.width stays 0 for them.                      */
+  if (cnt > 1 && blk_bus.width && blk_app (mci) &&
+      mci->drv->Command (SET_WR_BLK_ERASE_COUNT, cnt, RESP_SHORT, r)) {
+    blk_stat.erased += cnt;
+  }
+#endif
+  if (!mci_WriteSector (sect, buf, cnt, mci)) {
+    blk_forget (sect, cnt);             /* the card may hold either data     */
+    blk_fcl = 0xFFFFFFFF;
+    return (__FALSE);
+  }
+  if (sect < blk_fat) {
+    blk_boot (sect, buf);               /* FORMAT lays out a new volume      */
+  }
+  else {
+    blk_fat_upd (sect, buf, cnt);       /* before the cache takes the data   */
+    blk_put (sect, buf, cnt, (blk_class (sect, __TRUE) == BLK_META) ? BLK_META : BLK_FREE);
+  }
+  return (__TRUE);
+}
+
+/*----------------------------------------------------------------------------
+ *        Tune the SD bus. The read-ahead slots serve as buffers.
+ *---------------------------------------------------------------------------*/
+static void blk_tune (MCI_DEV *mci) {
+  U8 *ref = (U8 *)BLK_RA_ADDR;
+  U8 *tst = ref + BLK_TUNE_SECTS * 512;
+  U32 r[4], spec, widths, khz, t0, t, i;
+
+  memset (&blk_bus, 0, sizeof (blk_bus));
+  blk_tuned = __FALSE;
+
+  /* SCR: spec version and bus widths. MMC cards have none, their bus
+     stays as mci_Init() left it.                                      */
+  if (!blk_app (mci) || !mci_rd_data (SEND_SCR, 0, tst, 8)) {
+    return;
+  }
+  memcpy (blk_scr, tst, 8);
+  spec   = tst[0] & 0x0F;
+  widths = tst[1] & 0x0F;
+
+  /* 4-bit bus where offered, the SD status tells if the card took it. */
+  blk_bus.width = 1;
+  if (widths & 0x04) {
+    if (blk_app (mci) && mci->drv->Command (SET_ACMD_BUS_WIDTH, 2, RESP_SHORT, r)) {
+      mci->drv->BusWidth (4);
+      if (blk_app (mci) && mci_rd_data (SD_STATUS, 0, ref, 64) && (ref[0] >> 6) == 2) {
+        blk_bus.width = 4;
+      }
+    }
+    if (blk_bus.width == 1) {
+      blk_app (mci);
+      mci->drv->Command (SET_ACMD_BUS_WIDTH, 0, RESP_SHORT, r);
+      mci->drv->BusWidth (1);
+    }
+  }
+
+  /* SD 1.10 and later have CMD6, ask for the high speed function first. */
+  if (spec >= 1 && mci_rd_data (SWITCH_FUNC, 0x00FFFFF1, ref, 64) &&
+      (ref[13] & 0x02)) {
+    if (mci_rd_data (SWITCH_FUNC, 0x80FFFFF1, ref, 64) && (ref[16] & 0x0F) == 1) {
+      blk_bus.hs = 1;
+    }
+  }
+  khz = blk_bus.hs ? 50000 : 25000;
+
+  /* Reference sectors at the identification clock, any card reads them. */
+  mci->drv->BusSpeed (400);
+  if (!mci_ReadSector (0, ref, BLK_TUNE_SECTS, mci)) {
+    mci->drv->BusSpeed (khz);
+    blk_bus.khz = mci_bus_khz;
+    return;
+  }
+
+  /* Step down from the fastest clock the card allows until the reference
+     reads back unchanged. BusSpeed() caps the clock at SD_CLK.          */
+  for ( ; ; khz = mci_bus_khz - 1) {
+    mci->drv->BusSpeed (khz);
+    if (mci_bus_khz <= 400 || blk_same (mci, ref, tst)) {
+      break;
+    }
+  }
+  blk_bus.khz = mci_bus_khz;
+
+  /* Sequential read rate. Timer1 free runs at PCLK (12 MHz), like BENCH. */
+  PCONP |= (1 << 2);
+  T1PR  = 0;
+  T1TCR = 1;
+  t0 = T1TC;
+  for (i = 0; i < BLK_TUNE_KB * 2; i += 2 * BLK_TUNE_SECTS) {
+    if (!mci_ReadSector (i, ref, 2 * BLK_TUNE_SECTS, mci)) {
+      break;
+    }
+  }
+  t = T1TC - t0;
+  if (t) {
+    blk_bus.rd_kbs = (U32)(((U64)i / 2 * 12000000) / t);
+  }
+  blk_tuned = __TRUE;
+}
+
+/*----------------------------------------------------------------------------
+ *        Apply the last tuning again after mci_Init(), if the card is the
+ *        one it was made for. Returns __FALSE when it has to be tuned anew.
+ *---------------------------------------------------------------------------*/
+static BOOL blk_retune (MCI_DEV *mci) {
+  U8 *buf = (U8 *)BLK_RA_ADDR;
+  U32 r[4];
+
+  if (!blk_app (mci) || !mci_rd_data (SEND_SCR, 0, buf, 8) ||
+      memcmp (buf, blk_scr, 8) != 0) {
+    return (__FALSE);
+  }
+  if (!blk_app (mci) ||
+      !mci->drv->Command (SET_ACMD_BUS_WIDTH, (blk_bus.width == 4) ? 2 : 0,
+                          RESP_SHORT, r)) {
+    return (__FALSE);
+  }
+  mci->drv->BusWidth (blk_bus.width);
+  if (blk_bus.hs && !(mci_rd_data (SWITCH_FUNC, 0x80FFFFF1, buf, 64) &&
+                      (buf[16] & 0x0F) == 1)) {
+    return (__FALSE);
+  }
+  mci->drv->BusSpeed (blk_bus.khz);
+  return (mci_bus_khz == blk_bus.khz);
+}
+
+/*----------------------------------------------------------------------------
+ *        Read the reference sectors a few times at the current clock
+ *---------------------------------------------------------------------------*/
+static BOOL blk_same (MCI_DEV *mci, U8 *ref, U8 *tst) {
+  U32 i;
+
+  for (i = 0; i < 4; i++) {
+    memset (tst, 0, BLK_TUNE_SECTS * 512);
+    if (!mci_ReadSector (0, tst, BLK_TUNE_SECTS, mci) ||
+        memcmp (ref, tst, BLK_TUNE_SECTS * 512) != 0) {
+      return (__FALSE);
+    }
+  }
+  return (__TRUE);
+}
+
+/*----------------------------------------------------------------------------
+ *        APP_CMD, the next command is an application command
+ *---------------------------------------------------------------------------*/
+static BOOL blk_app (MCI_DEV *mci) {
+  U32 r[4];
+
+  return (mci->drv->Command (APP_CMD, mci->rca << 16, RESP_SHORT, r));
+}
+
+/*----------------------------------------------------------------------------
+ *        Cache class for a read of sector 'sect' on: FAT and root directory
+ *        sectors, other sectors read out of sequence. Sequential runs are
+ *        streamed file data, left to the read-ahead.
+ *---------------------------------------------------------------------------*/
+static U32 blk_class (U32 sect, BOOL seq) {
+
+  if (sect < blk_fat) {
+    return (BLK_FREE);                  /* volume not known yet, or reserved */
+  }
+  if (sect < blk_root) {
+    return (BLK_META);
+  }
+  return (seq ? BLK_FREE : BLK_PROB);
+}
+
+/*----------------------------------------------------------------------------
+ *        Cache line of sector 'sect', NULL when not cached
+ *---------------------------------------------------------------------------*/
+static BLK_LINE *blk_lookup (U32 sect) {
+  U32 i;
+
+  for (i = 0; i < BLK_CACHE_SECTS; i++) {
+    if (blk_line[i].cls != BLK_FREE && blk_line[i].sect == sect) {
+      return (&blk_line[i]);
+    }
+  }
+  return (NULL);
+}
+
+/*----------------------------------------------------------------------------
+ *        Copy sectors from the cache, when all of them are there
+ *---------------------------------------------------------------------------*/
+static BOOL blk_get (U32 sect, U8 *buf, U32 cnt) {
+  BLK_LINE *lp;
+  U32 i;
+
+  if (cnt > BLK_CACHE_SECTS) {
+    return (__FALSE);
+  }
+  for (i = 0; i < cnt; i++) {
+    if (blk_lookup (sect + i) == NULL) {
+      return (__FALSE);
+    }
+  }
+  for (i = 0; i < cnt; i++) {
+    lp = blk_lookup (sect + i);
+    memcpy (buf + i * 512, BLK_LINE_BUF (lp), 512);
+    blk_touch (lp);
+  }
+  return (__TRUE);
+}
+
+/*----------------------------------------------------------------------------
+ *        Store sectors read or written. Cached ones are updated, others
+ *        take a line of class 'cls', BLK_FREE updates only.
+ *---------------------------------------------------------------------------*/
+static void blk_put (U32 sect, const U8 *buf, U32 cnt, U32 cls) {
+  BLK_LINE *lp;
+  U32 i;
+
+  for (i = 0; i < cnt; i++, buf += 512) {
+    if ((lp = blk_lookup (sect + i)) != NULL) {
+      memcpy (BLK_LINE_BUF (lp), buf, 512);
+      continue;
+    }
+    if (cls == BLK_FREE || cnt > BLK_CACHE_SECTS || (lp = blk_victim (cls)) == NULL) {
+      continue;
+    }
+    if (lp->cls != BLK_FREE) {
+      blk_cstat.evicts++;
+    }
+    lp->sect = sect + i;
+    lp->cls  = cls;
+    lp->used = ++blk_tick;
+    memcpy (BLK_LINE_BUF (lp), buf, 512);
+  }
+}
+
+/*----------------------------------------------------------------------------
+ *        Line 'lp' was read again: most recently used, and protected when
+ *        it was on probation. The oldest protected line then goes back to
+ *        probation if the protected segment grew beyond half the cache.
+ *---------------------------------------------------------------------------*/
+static void blk_touch (BLK_LINE *lp) {
+#if BLK_CACHE_SLRU
+  BLK_LINE *old;
+  U32 i, n;
+#endif
+
+  lp->used = ++blk_tick;
+#if BLK_CACHE_SLRU
+  if (lp->cls != BLK_PROB) {
+    return;
+  }
+  lp->cls = BLK_PROT;
+  old = NULL;
+  for (i = n = 0; i < BLK_CACHE_SECTS; i++) {
+    if (blk_line[i].cls == BLK_PROT) {
+      n++;
+      if (old == NULL || (S32)(blk_line[i].used - old->used) < 0) {
+        old = &blk_line[i];
+      }
+    }
+  }
+  if (n > BLK_CACHE_SECTS / 2) {
+    old->cls = BLK_PROB;
+  }
+#endif
+}
+
+/*----------------------------------------------------------------------------
+ *        Line for a new sector of class 'cls': a free one, else the least
+ *        recently used of the lowest class. File data never takes a FAT
+ *        line, NULL then.
+ *---------------------------------------------------------------------------*/
+static BLK_LINE *blk_victim (U32 cls) {
+  BLK_LINE *lp, *v = NULL;
+  U32 i;
+
+  for (i = 0; i < BLK_CACHE_SECTS; i++) {
+    lp = &blk_line[i];
+    if (lp->cls == BLK_FREE) {
+      return (lp);
+    }
+    if (lp->cls == BLK_META && cls != BLK_META) {
+      continue;
+    }
+    if (v == NULL || lp->cls < v->cls ||
+        (lp->cls == v->cls && (S32)(lp->used - v->used) < 0)) {
+      v = lp;
+    }
+  }
+  return (v);
+}
+
+/*----------------------------------------------------------------------------
+ *        Drop cached sectors 'sect'..'sect + cnt - 1'
+ *---------------------------------------------------------------------------*/
+static void blk_forget (U32 sect, U32 cnt) {
+  U32 i;
+
+  for (i = 0; i < BLK_CACHE_SECTS; i++) {
+    if (blk_line[i].sect - sect < cnt) {
+      blk_line[i].cls = BLK_FREE;
+    }
+  }
+  if (cnt == 0xFFFFFFFF) {
+    blk_fat = 0xFFFFFFFF;               /* the volume has to be read again   */
+    blk_spc = 0;
+    blk_fcl = 0xFFFFFFFF;
+    blk_gen++;
+  }
+}
+
+/*----------------------------------------------------------------------------
+ *        Take the volume layout from a master boot record or a boot sector.
+ *        A layout other than the cached one empties the cache.
+ *---------------------------------------------------------------------------*/
+static void blk_boot (U32 sect, const U8 *p) {
+  U32 fat, root, vsn, fsz, sn, tot;
+
+  if (p[510] != 0x55 || p[511] != 0xAA) {
+    return;
+  }
+  if (!((p[0] == 0xEB || p[0] == 0xE9) && p[11] == 0 && p[12] == 2)) {
+    if (sect == 0) {
+      blk_vol = p[454] | (p[455] << 8) | (p[456] << 16) | ((U32)p[457] << 24);
+    }
+    return;
+  }
+  if (sect == 0) {
+    blk_vol = 0;                        /* no partition table                */
+  }
+  if (sect != blk_vol || p[13] == 0 || p[16] == 0) {
+    return;                             /* FAT32 backup boot sector          */
+  }
+  fsz = p[22] | (p[23] << 8);
+  sn  = 39;
+  if (fsz == 0) {
+    fsz = p[36] | (p[37] << 8) | (p[38] << 16) | ((U32)p[39] << 24);
+    sn  = 67;                           /* FAT32 extended boot record        */
+  }
+  fat  = sect + (p[14] | (p[15] << 8));
+  root = fat + p[16] * fsz + ((p[17] | (p[18] << 8)) * 32 + 511) / 512;
+  vsn  = p[sn] | (p[sn+1] << 8) | (p[sn+2] << 16) | ((U32)p[sn+3] << 24);
+  if (fat != blk_fat || root != blk_root || vsn != blk_vsn) {
+    blk_forget (0, 0xFFFFFFFF);
+    blk_fat  = fat;
+    blk_root = root;
+    blk_vsn  = vsn;
+  }
+  blk_spc = p[13];
+
+  /* The FAT type follows from the cluster count alone. */
+  tot = p[19] | (p[20] << 8);
+  if (tot == 0) {
+    tot = p[32] | (p[33] << 8) | (p[34] << 16) | ((U32)p[35] << 24);
+  }
+  blk_fsz   = fsz;
+  tot       = (tot - (root - sect)) / blk_spc;
+  blk_fbits = (tot < 4085) ? 12 : (tot < 65525) ? 16 : 32;
+}
+
+/*----------------------------------------------------------------------------
+ *        Move the free cluster count by the entries of the first FAT that
+ *        'buf' turns used or free, the cache still holds the old sectors
+ *---------------------------------------------------------------------------*/
+static void blk_fat_upd (U32 sect, const U8 *buf, U32 cnt) {
+  BLK_LINE *lp;
+  const U8 *old;
+  U32 i, o, n, w;
+
+  w = blk_fbits / 8;
+  for ( ; cnt && blk_fcl != 0xFFFFFFFF; sect++, buf += 512, cnt--) {
+    if (sect - blk_fat >= blk_fsz) {
+      continue;
+    }
+    if (w == 1 || (lp = blk_lookup (sect)) == NULL) {
+      blk_fcl = 0xFFFFFFFF;             /* count again at the next query     */
+      return;
+    }
+    old = BLK_LINE_BUF (lp);
+    for (i = 0; i < 512; i += w) {
+      o = old[i] | (old[i+1] << 8);
+      n = buf[i] | (buf[i+1] << 8);
+      if (w == 4) {
+        o |= (old[i+2] << 16) | ((old[i+3] & 0x0F) << 24);
+        n |= (buf[i+2] << 16) | ((buf[i+3] & 0x0F) << 24);
+      }
+      if (o == 0 && n != 0) {
+        blk_fcl--;
+      }
+      else if (o != 0 && n == 0) {
+        blk_fcl++;
+      }
+    }
+  }
+}
+
+/*----------------------------------------------------------------------------
+ *        Free space of the mounted volume [bytes]
+ *---------------------------------------------------------------------------*/
+U64 blk_free (void) {
+
+  if (blk_spc == 0) {
+    return (ffree (""));                /* volume layout not seen            */
+  }
+  if (blk_fcl == 0xFFFFFFFF) {
+    blk_fcl = (U32)(ffree ("") / (blk_spc * 512));
+  }
+  return ((U64)blk_fcl * blk_spc * 512);
+}
+
+#if MCI_IRQ
+/*----------------------------------------------------------------------------
+ *        Slot that holds or awaits sector 'sect'
+ *---------------------------------------------------------------------------*/
+static BLK_SLOT *blk_find (U32 sect) {
+  U32 i;
+
+  for (i = 0; i < BLK_RA_SLOTS; i++) {
+    if (blk_slot[i].valid && sect >= blk_slot[i].rq.sect &&
+        sect < blk_slot[i].rq.sect + blk_slot[i].rq.cnt) {
+      return (&blk_slot[i]);
+    }
+  }
+  return (NULL);
+}
+
+/*----------------------------------------------------------------------------
+ *        Keep the sectors from 'from' on in flight, as far as slots allow
+ *---------------------------------------------------------------------------*/
+static void blk_ahead (U32 from) {
+  BLK_SLOT *sp;
+  U32 i;
+
+  if (blk_next < from || blk_next > from + BLK_RA_SLOTS * BLK_RA_SECTS) {
+    blk_next = from;                    /* the stream jumped, start over     */
+  }
+  for (i = 0; i < BLK_RA_SLOTS; i++) {
+    sp = &blk_slot[i];
+    if (sp->valid && (sp->rq.sect + sp->rq.cnt <= from || sp->rq.sect >= blk_next) &&
+        sp->rq.stat != MCI_RQ_QUEUED && sp->rq.stat != MCI_RQ_BUSY) {
+      sp->valid = __FALSE;              /* outside the window, never used    */
+    }
+  }
+  for (i = 0; i < BLK_RA_SLOTS; i++) {
+    sp = &blk_slot[i];
+    if (sp->valid || sp->rq.stat == MCI_RQ_QUEUED || sp->rq.stat == MCI_RQ_BUSY) {
+      continue;
+    }
+    if (blk_next + BLK_RA_SECTS > blk_cnt) {
+      break;                            /* stay inside the card              */
+    }
+    sp->rq.sect = blk_next;
+    sp->rq.cnt  = BLK_RA_SECTS;
+    if (!mci_rd_submit (&sp->rq)) {
+      break;
+    }
+    sp->valid  = __TRUE;
+    blk_next  += BLK_RA_SECTS;
+    blk_stat.ahead += BLK_RA_SECTS;
+  }
+}
+
+/*----------------------------------------------------------------------------
+ *        Forget read-ahead data of sectors 'sect'..'sect + cnt - 1'
+ *---------------------------------------------------------------------------*/
+static void blk_drop (U32 sect, U32 cnt) {
+  BLK_SLOT *sp;
+  U32 i;
+
+  for (i = 0; i < BLK_RA_SLOTS; i++) {
+    sp = &blk_slot[i];
+    if (sp->valid && sect < sp->rq.sect + sp->rq.cnt &&
+        sp->rq.sect < sect + cnt) {
+      mci_rd_wait (&sp->rq);            /* the buffer is busy until done     */
+      sp->valid = __FALSE;
+    }
+  }
+}
+#endif
+
+/*----------------------------------------------------------------------------
+ * end of file
+ *---------------------------------------------------------------------------*/
@@ -0,0 +1,92 @@
+/*----------------------------------------------------------------------------
+ *      Name:    SD_BLOCK.H
+ *      Purpose: Sector layer between FlashFS and the MCI driver
+ *---------------------------------------------------------------------------*/
+
+#ifndef __SD_BLOCK_H
+#define __SD_BLOCK_H
+
+/* RAM budget. The GPDMA reaches only the two AHB RAMs and every buffer
+   below is a DMA target or sits with them, both blocks are fully used:
+
+   USB RAM 0x7FD00000, 8 KB
+     +0x0000  MC0 cache, MC0_CASZ 4 KB and its FAT buffer         5 KB
+     +0x1400  MCI DMA list, MCI_LLI_CNT items of 16 bytes         1 KB
+     +0x1800  Sector cache, BLK_CACHE_SECTS of 512 bytes          2 KB
+   Ethernet RAM 0x7FE00000, 16 KB
+     +0x0000  Audio ring, AUD_SEG_CNT segments                    8 KB
+     +0x2000  Wave header, AUD_HDR_SIZE                         0.5 KB
+     +0x2200  Read-ahead slots, BLK_RA_SLOTS * BLK_RA_SECTS       4 KB
+     +0x3200  Raw stream halves and meta sector (SD_Raw.h)      3.5 KB
+
+   A change to one of these sizes moves the entries behind it.           */
+
+/* Read-ahead buffers in Ethernet RAM, behind the audio ring and the wave
+   header buffer. Slots are filled by the asynchronous read queue.        */
+#define BLK_RA_ADDR     0x7FE02200      /* Slot storage base address         */
+#define BLK_RA_SLOTS    2               /* Reads kept in flight              */
+#define BLK_RA_SECTS    4               /* Sectors per slot                  */
+
+/* Sector cache in the tail of USB RAM, behind the MC0 cache and the MCI
+   DMA list. SD_Block.c stops the build when BLK_CACHE_SECTS does not fit
+   the space those leave. The CPU fills it, so a larger cache may sit in
+   local RAM instead: BLK_CACHE_ADDR 0 makes it a static array there. FAT
+   and root directory sectors are a class of their own that file data
+   never displaces.                                                      */
+#define BLK_USB_RAM_END 0x7FD02000      /* End of USB RAM                    */
+#define BLK_CACHE_ADDR  (MCI_LLI_ADDR + MCI_LLI_CNT * 16)  /* 0 = local RAM */
+#define BLK_CACHE_SECTS 4               /* Sectors cached, 512 bytes each    */
+#define BLK_CACHE_SLRU  1               /* 1 = segmented LRU, 0 = plain LRU  */
+
+/* Multi-sector writes tell SD cards their length first (ACMD23), so that
+   the card erases the run at once instead of block by block.           */
+#define BLK_PRE_ERASE   1
+
+typedef struct blk_stat {
+  U32 hits;                             /* Sectors served from read-ahead    */
+  U32 misses;                           /* Sectors read from the card        */
+  U32 ahead;                            /* Sectors read ahead                */
+  U32 erased;                           /* Sectors written pre-erased        */
+} BLK_STAT;
+
+extern BLK_STAT blk_stat;
+
+/* Sector cache counters, [0] file data and directories, [1] FAT and root */
+typedef struct blk_cstat {
+  U32 hits[2];                          /* Sectors served from the cache     */
+  U32 misses[2];                        /* Cacheable sectors not found       */
+  U32 evicts;                           /* Lines taken for other sectors     */
+} BLK_CSTAT;
+
+extern BLK_CSTAT blk_cstat;
+
+/* SD bus settings chosen by the tuning at mount */
+typedef struct blk_bus {
+  U32 khz;                              /* Bus clock, 0 = not tuned (MMC)    */
+  U32 rd_kbs;                           /* Sequential read [KB/s]            */
+  U8  width;                            /* Data lines, 1 or 4                */
+  U8  hs;                               /* Card switched to high speed       */
+} BLK_BUS;
+
+extern BLK_BUS blk_bus;
+
+/* Cluster size of the mounted volume [sectors], 0 = not known yet */
+extern U32 blk_spc;
+
+/* Bumped by every sector write and every volume change, whatever was read
+   from the directory before may be out of date once it moved.          */
+extern U32 blk_gen;
+
+/* Free space, ffree("") without the FAT scan after the first query */
+extern U64 blk_free (void);
+
+/* MCI layer entries, File_Config.c routes File_lib.c through these */
+extern BOOL blk_Init        (U32 mode, MCI_DEV *mci);
+extern BOOL blk_ReadSector  (U32 sect, U8 *buf, U32 cnt, MCI_DEV *mci);
+extern BOOL blk_WriteSector (U32 sect, U8 *buf, U32 cnt, MCI_DEV *mci);
+
+#endif
+
+/*----------------------------------------------------------------------------
+ * end of file
+ *---------------------------------------------------------------------------*/
@@ -15,8 +15,13 @@
 #include "File_Config.h"
 #include "SD_File.h"
 #include "LCD.h"
+#include "Audio.h"
+#include "Track.h"
+#include "Dir.h"
+#include "MCI_LPC23xx.h"
+#include "SD_Block.h"
+#include "SD_Raw.h"
 #include <LPC23xx.H>
-#define MEM_LEN 1024
 
 //Defining port numbers
 #define PLAY 0x2000
@@ -24,36 +29,42 @@
 #define BACK 0x0800
 #define FORW 0x0400
 
+//FORW/BACK seek: first step, then repeated and doubled while held
+#define SEEK_STEP_MS   2000
+#define SEEK_MAX_MS    32000
+#define SEEK_REPEAT_MS 250
 
+//DIR /P: lines per page
+#define DIR_PAGE       20
 
-__irq void T0_IRQHandler(void);
-__irq void ADC_IRQHandler(void);
-__irq void EINT3_IRQHandler  (void);
+//CAP: least data written at a time, unless ESC or the ring end comes first
+#define CAP_BLOCK      2048
 
+//FILL modes, text lines or a raw pattern
+#define FILL_TEXT      0
+#define FILL_BYTE      1 /* one byte value                     */
+#define FILL_COUNT     2 /* 32-bit counter                     */
+#define FILL_RAND      3 /* xorshift32 words                   */
+#define FILL_MAX_KB    (0xFFFFFFFF / 1024) /* FAT files end below 4 GB */
 
+//BENCH: latency histogram, four buckets per octave of Timer1 ticks
+#define LAT_BKT        100
+
+//BENCH test number bits
+#define BENCH_RD       1 /* read, else write                  */
+#define BENCH_RND      2 /* random positions, else sequential */
+#define BENCH_SECT     4 /* mc0_drv sectors, else stdio       */
+
+//Play all *.WAV files in a loop instead of running the command console
+#ifndef AUTOPLAY
+#define AUTOPLAY 1
+#endif
+
+
+
+__irq void ADC_IRQHandler(void);
+__irq void EINT3_IRQHandler  (void);
 
-//Audio File being read
-struct audioData {
-  long long int totSize;
-  U64 readSize;
-  long int numChannels;
-  long long int sampleRate;
-  long int sampleSize;
-  long long int Subchunk1Size;
-  long int PCM;
-  long long int curPos;
-  FILE * f;
-  char md;
-  char bufrs[MEM_LEN];
-  int pos;
-  int buf;
-  int swi;
-  int vol;
-  int ct;
-  
-  int stat;
-}
-curAudio;
 
 
 
@@ -63,12 +74,17 @@ static void cmd_capture(char * par);
 static void cmd_type(char * par);
 static void cmd_rename(char * par);
 static void cmd_copy(char * par);
+static void cmd_sum(char * par);
 static void cmd_delete(char * par);
 static void cmd_dir(char * par);
 static void cmd_format(char * par);
 static void cmd_help(char * par);
 static void cmd_fill(char * par);
 static void cmd_play(char * par);
+static void cmd_playall(char * par);
+static void cmd_index(char * par);
+static void cmd_bench(char * par);
+static void cmd_cache(char * par);
 
 /* Local constants */
 static
@@ -81,82 +97,100 @@ const char help[] =
   "+ command ------------------+ function ---------------------------------+\n"
 "| CAP \"fname\" [/A]          | captures serial data to a file            |\n"
 "|                           |  [/A option appends data to a file]       |\n"
-"| FILL \"fname\" [nnnn]       | create a file filled with text            |\n"
+"| FILL \"fname\" [nnnn] [/opt]| create a file filled with text            |\n"
 "|                           |  [nnnn - number of lines, default=1000]   |\n"
+"|                           |  [/B[:hh] byte, /C counter, /R random     |\n"
+"|                           |   pattern instead, nnnn in kbytes]        |\n"
 "| TYPE \"fname\"              | displays the content of a text file       |\n"
 "| REN \"fname1\" \"fname2\"     | renames a file 'fname1' to 'fname2'       |\n"
 "| COPY \"fin\" [\"fin2\"] \"fout\"| copies a file 'fin' to 'fout' file        |\n"
 "|                           |  ['fin2' option merges 'fin' and 'fin2']  |\n"
+"| SUM \"fname\" [\"fname2\"]    | CRC32 of a file and the read rate         |\n"
+"|                           |  ['fname2' option compares the two]       |\n"
 "| DEL \"fname\"               | deletes a file                            |\n"
-"| DIR \"[mask]\"              | displays a list of files in the directory |\n"
+"| DIR \"[mask]\" [/opt]       | displays a list of files in the directory |\n"
+"|                           |  [/N /S /D sort by name, size, date]      |\n"
+"|                           |  [/P pauses after every page]             |\n"
 "| FORMAT [label [/FAT32]]   | formats Flash Memory Card                 |\n"
 "|                           | [/FAT32 option selects FAT32 file system] |\n"
 "| PLAY                      | Display and play song                     |\n"
+"| PLAYALL \"[mask]\"          | plays matching files without gaps         |\n"
+"|                           |  [default mask is *.WAV]                  |\n"
+"| INDEX \"[mask]\"            | rebuilds the track index TRACKS.IDX       |\n"
+"| BENCH [kbytes]            | card read/write speed and latency, stdio  |\n"
+"|                           |  and sectors, sequential and random       |\n"
+"|                           |  [kbytes per test, default=512]           |\n"
+"| CACHE [/R]                | sector cache hit and miss counts          |\n"
+"|                           |  [/R option resets the counts]            |\n"
 "| HELP  or  ?               | displays this help                        |\n"
 "+---------------------------+-------------------------------------------+\n";
 
 static
 const SCMD cmd[] = {
-  "CAP",
-  cmd_capture,
-  "TYPE",
-  cmd_type,
-  "REN",
-  cmd_rename,
-  "COPY",
-  cmd_copy,
-  "DEL",
-  cmd_delete,
-  "DIR",
-  cmd_dir,
-  "FORMAT",
-  cmd_format,
-  "HELP",
-  cmd_help,
-  "FILL",
-  cmd_fill,
-  "?",
-  cmd_help,
-  "PLAY",
-  cmd_play
+  { "CAP",     cmd_capture },
+  { "TYPE",    cmd_type },
+  { "REN",     cmd_rename },
+  { "COPY",    cmd_copy },
+  { "SUM",     cmd_sum },
+  { "DEL",     cmd_delete },
+  { "DIR",     cmd_dir },
+  { "FORMAT",  cmd_format },
+  { "HELP",    cmd_help },
+  { "FILL",    cmd_fill },
+  { "?",       cmd_help },
+  { "PLAY",    cmd_play },
+  { "PLAYALL", cmd_playall },
+  { "INDEX",   cmd_index },
+  { "BENCH",   cmd_bench },
+  { "CACHE",   cmd_cache }
 };
 
-#define CMD_COUNT(sizeof(cmd) / sizeof(cmd[0]))
+#define CMD_COUNT (sizeof(cmd) / sizeof(cmd[0]))
 
 /* Local variables */
 static char in_line[160];
+static BOOL play_idx; /* playlist comes from the track index   */
+static BOOL play_raw; /* data streams past FlashFS, SD_Raw.c   */
+static U32 play_sec; /* play time on the LCD, in seconds     */
+static FILE * copy_out; /* COPY destination, for copy_put()    */
+static U32 sum_crc; /* running CRC of SUM, for sum_put()   */
+static U32 crc_tab[4][256]; /* slicing-by-4 tables, by crc_init()  */
+
+/* BENCH results of one test, times in Timer1 ticks */
+typedef struct bench_res {
+  U32 ops; /* transfers done                       */
+  U32 sum; /* sum of the transfer times            */
+  U32 min;
+  U32 max;
+  U32 close; /* fclose(), writes out the last data   */
+  U16 hist[LAT_BKT]; /* transfer time histogram              */
+} BENCH_RES;
 
 /* Local Function Prototypes */
 static void dot_format(U64 val, char * sp);
+static void show_rate(U32 bytes, const char * what, U64 ticks);
+static U32 fill_utoa(U8 * sp, U32 val);
+static void fill_words(U32 * wp, U32 cnt, U32 mode, U32 * state);
 static char * get_entry(char * cp, char ** pNext);
 static void init_card(void);
+static U32 file_stream(FILE * fin, char * fname, BOOL( * put)(U8 * p, U32 n), U64 * ticks);
+static BOOL copy_put(U8 * p, U32 n);
+static BOOL sum_put(U8 * p, U32 n);
+static void crc_init(void);
+static U32 crc_calc(U32 crc, const U8 * p, U32 n);
+static U32 sum_file(char * fname, U32 * size);
+static void play_fill(U64 * left, U32 frame);
+static BOOL play_open(char * fname, const AUD_FMT * known);
+static BOOL play_open_next(void);
+static void play_seek(S32 ms, U32 mark, U64 * left, U32 frame);
+static U32 play_pos(U32 frame);
+static void play_time(U32 frame);
+static void play_list(char * fname, char * mask);
+static BOOL bench_run(U32 test, U32 size, U32 cnt, U32 base, BENCH_RES * r);
+static void bench_lat(BENCH_RES * r, U32 t);
+static U32 bench_pct(BENCH_RES * r, U32 pct);
 
 
-void clearAudData(){
-    
-    fclose(curAudio.f);
-    curAudio.totSize = 0;
-    curAudio.curPos = 0;
-    curAudio.md = 0;
-    curAudio.readSize = 0;
-    curAudio.numChannels = 0;
-    curAudio.sampleRate = 0;
-    curAudio.sampleSize = 0;
-    curAudio.Subchunk1Size = 0;
-    curAudio.PCM = 0;
-   
-    curAudio.pos = 0;
-    curAudio.buf = 0;
-    curAudio.swi = 0;
-    curAudio.vol = 0;
-    curAudio.ct = 0;
-
-    //curAudio.stat = 0;
-    
-    VICIntEnClr = (1 << 4);
-    T0TCR = 0;
-}
-
 /*----------------------------------------------------------------------------
  *        Process input string for long or short name entry
  *---------------------------------------------------------------------------*/
@@ -221,12 +255,29 @@ static void dot_format(U64 val, char * sp) {
   sprintf(sp, "%d", (U32)(val));
 }
 
+/*----------------------------------------------------------------------------
+ *        Print a transfer size, its time in Timer1 ticks and the rate
+ *---------------------------------------------------------------------------*/
+static void show_rate(U32 bytes, const char * what, U64 ticks) {
+  char temp[32];
+  U32 ms, rate;
+
+  dot_format(bytes, & temp[0]);
+  ms = (U32)(ticks / 12000);
+  rate = ms ? (U32)((U64) bytes * 1000 / ms / 10486) : 0;
+  printf("\n%s bytes %s in %d.%03d s, %d.%02d MB/s.\n", temp, what,
+    ms / 1000, ms % 1000, rate / 100, rate % 100);
+}
+
 /*----------------------------------------------------------------------------
  *        Capture serial data to file
  *---------------------------------------------------------------------------*/
 static void cmd_capture(char * par) {
   char * fname, * next;
-  BOOL append, retv;
+  U8 * ring = (U8 * ) AUD_RING_ADDR; /* idle while the console runs */
+  U8 * p, * esc;
+  U32 pos, n, w, total;
+  BOOL append;
   FILE * f;
 
   fname = get_entry(par, & next);
@@ -252,20 +303,48 @@ static void cmd_capture(char * par) {
     printf("\nCan not open file!\n"); /* error when trying to open file    */
     return;
   }
+
+  /* The receive interrupt fills the audio ring meanwhile, the data goes
+     to the card from there. Writes end on a sector boundary of the file,
+     except the last one before the ring wraps. The writer is this loop:
+     FlashFS is not reentrant and belongs to the console, an interrupt
+     can not append to the file. The ring is the player's, CAP does not
+     run during playback.                                              */
+  pos = (U32) ftell(f);
+  total = 0;
+  ser_rx_lost = 0;
+  ser_rx_ring(ring, AUD_SEG_CNT * AUD_SEG_BYTES);
   do {
-    retv = getline(in_line, sizeof(in_line));
-    fputs(in_line, f);
-  } while (retv == __TRUE);
+    p = ser_rx_get( & n);
+    esc = memchr(p, ESC, n);
+    if (esc != NULL) {
+      w = esc - p;
+    } else if (p + n == ring + AUD_SEG_CNT * AUD_SEG_BYTES) {
+      w = n;
+    } else if (n >= CAP_BLOCK) {
+      w = n - (pos + n) % 512;
+    } else {
+      continue;
+    }
+    fwrite(p, 1, w, f);
+    ser_rx_used((esc != NULL) ? w + 1 : w);
+    pos += w;
+    total += w;
+  } while (esc == NULL);
+  ser_rx_ring(NULL, 0);
   fclose(f); /* close the output file               */
-  printf("\nFile closed.\n");
+  printf("\n%d bytes captured, %d lost.\nFile closed.\n", total, ser_rx_lost);
 }
 
 /*----------------------------------------------------------------------------
  *        Create a file and fill it with some text
  *---------------------------------------------------------------------------*/
 static void cmd_fill(char * par) {
-  char * fname, * next;
+  char * fname, * next, * opt, tail[176];
+  U8 * buf = (U8 * ) AUD_RING_ADDR; /* idle while the console runs */
   FILE * f;
+  U32 mode, pat, chunk, pos, tlen, total, n, t, now;
+  U64 ticks;
   int i, cnt = 1000;
 
   fname = get_entry(par, & next);
@@ -273,24 +352,137 @@ static void cmd_fill(char * par) {
     printf("\nFilename missing.\n");
     return;
   }
-  if (next) {
-    par = get_entry(next, & next);
-    if (sscanf(par, "%d", & cnt) == 0) {
-      printf("\nCommand error.\n");
-      return;
+  mode = FILL_TEXT;
+  pat = 0;
+  for (opt = get_entry(next, & next); opt != NULL; opt = get_entry(next, & next)) {
+    if (opt[0] != '/') {
+      if (sscanf(opt, "%d", & cnt) != 1 || cnt < 0) {
+        printf("\nCommand error.\n");
+        return;
+      }
+      continue;
+    }
+    switch (toupper(opt[1])) {
+      case 'B':
+        mode = FILL_BYTE;
+        if (opt[2] == ':' && sscanf( & opt[3], "%x", & pat) != 1) {
+          printf("\nCommand error.\n");
+          return;
+        }
+        break;
+      case 'C':
+        mode = FILL_COUNT;
+        break;
+      case 'R':
+        mode = FILL_RAND;
+        pat = 2463534242u; /* xorshift32 seed, any but 0 */
+        break;
+      default:
+        printf("\nCommand error.\n");
+        return;
     }
   }
+  if (mode != FILL_TEXT && (U32) cnt > FILL_MAX_KB) {
+    printf("\nFile size over 4 GB.\n");
+    return;
+  }
 
   f = fopen(fname, "w"); /* open a file for writing           */
   if (f == NULL) {
     printf("\nCan not open file!\n"); /* error when trying to open file    */
     return;
   }
-  for (i = 0; i < cnt; i++) {
-    fprintf(f, "This is line # %d in file %s\n", i, fname);
+
+  /* Whole clusters per fwrite(), up to half the ring: a text line may run
+     past the chunk into the other half.                                */
+  chunk = AUD_SEG_CNT * AUD_SEG_BYTES / 2;
+  if (blk_spc && blk_spc * 512 < chunk) {
+    chunk = blk_spc * 512;
+  }
+  PCONP |= (1 << 2); /* Timer1 at PCLK (12 MHz) as the time base */
+  T1PR = 0;
+  T1TCR = 1;
+  ticks = 0;
+  total = 0;
+  t = T1TC;
+  if (mode == FILL_TEXT) {
+    tlen = sprintf(tail, " in file %s\n", fname);
+    pos = 0;
+    for (i = 0; i < cnt; i++) {
+      memcpy( & buf[pos], "This is line # ", 15);
+      pos += 15;
+      pos += fill_utoa( & buf[pos], i);
+      memcpy( & buf[pos], tail, tlen);
+      pos += tlen;
+      if (pos >= chunk) {
+        fwrite(buf, 1, chunk, f);
+        total += chunk;
+        pos -= chunk;
+        memcpy(buf, & buf[chunk], pos);
+        now = T1TC; /* summed up per chunk, Timer1 wraps in minutes */
+        ticks += now - t;
+        t = now;
+      }
+    }
+    fwrite(buf, 1, pos, f);
+    total += pos;
+  } else {
+    if (mode == FILL_BYTE) {
+      memset(buf, pat, chunk);
+    }
+    for (n = (U32) cnt * 1024; n; n -= pos) {
+      pos = (n < chunk) ? n : chunk;
+      if (mode != FILL_BYTE) {
+        fill_words((U32 * ) buf, (pos + 3) / 4, mode, & pat);
+      }
+      fwrite(buf, 1, pos, f);
+      total += pos;
+      now = T1TC;
+      ticks += now - t;
+      t = now;
+    }
   }
   fclose(f); /* close the output file               */
-  printf("\nFile closed.\n");
+  ticks += T1TC - t;
+  show_rate(total, "written", ticks);
+  printf("File closed.\n");
+}
+
+/*----------------------------------------------------------------------------
+ *        Decimal digits of 'val' at 'sp', returns their number
+ *---------------------------------------------------------------------------*/
+static U32 fill_utoa(U8 * sp, U32 val) {
+  U8 tmp[10];
+  U32 n, i;
+
+  n = 0;
+  do {
+    tmp[n++] = '0' + val % 10;
+    val /= 10;
+  } while (val);
+  for (i = 0; i < n; i++) {
+    sp[i] = tmp[n - 1 - i];
+  }
+  return (n);
+}
+
+/*----------------------------------------------------------------------------
+ *        Next 'cnt' pattern words, '*state' carries on across calls
+ *---------------------------------------------------------------------------*/
+static void fill_words(U32 * wp, U32 cnt, U32 mode, U32 * state) {
+  U32 x = * state;
+
+  while (cnt--) {
+    if (mode == FILL_COUNT) {
+      * wp++ = x++;
+    } else {
+      x ^= x << 13;
+      x ^= x >> 17;
+      x ^= x << 5;
+      * wp++ = x;
+    }
+  }
+  * state = x;
 }
 
 /*----------------------------------------------------------------------------
@@ -299,7 +491,8 @@ static void cmd_fill(char * par) {
 static void cmd_type(char * par) {
   char * fname, * next;
   FILE * f;
-  int ch;
+  U8 * buf = (U8 * ) AUD_RING_ADDR; /* idle while the console runs */
+  U32 n;
 
   fname = get_entry(par, & next);
   if (fname == NULL) {
@@ -313,9 +506,9 @@ static void cmd_type(char * par) {
     return;
   }
 
-  while ((ch = fgetc(f)) != EOF) {
-    /* read the characters from the file   */
-    putchar(ch); /* and write them on the screen        */
+  while ((n = fread(buf, 1, 512, f)) != 0) {
+    /* read the file a sector at a time    */
+    fwrite(buf, 1, n, stdout); /* the UART sends it from its ring    */
   }
   fclose(f); /* close the input file when done      */
   printf("\nFile closed.\n");
@@ -368,8 +561,10 @@ static void cmd_rename(char * par) {
 static void cmd_copy(char * par) {
   char * fname, * fnew, * fmer, * next;
   FILE * fin, * fout;
-  U32 cnt, total;
-  char buf[512];
+  FINFO info;
+  U32 total, ms;
+  U64 need, ticks;
+  char buf[32];
   BOOL merge;
 
   fname = get_entry(par, & next);
@@ -395,6 +590,29 @@ static void cmd_copy(char * par) {
     return;
   }
 
+  /* The whole length up front: a copy that can not fit fails before it
+     writes anything, not half way through. FlashFS can not reserve the
+     clusters ahead of fwrite, this is the nearest it gets. An existing
+     destination is truncated by fopen, its space counts as free.     */
+  need = 0;
+  info.fileID = 0;
+  if (ffind(fname, & info) == 0) {
+    need = info.size;
+  }
+  info.fileID = 0;
+  if (merge && ffind(fmer, & info) == 0) {
+    need += info.size;
+  }
+  info.fileID = 0;
+  if (ffind(fnew, & info) == 0) {
+    need = (need > info.size) ? need - info.size : 0;
+  }
+  if (need > blk_free()) {
+    dot_format(need, & buf[0]);
+    printf("\nNot enough free space for %s bytes.\n", & buf[0]);
+    return;
+  }
+
   fin = fopen(fname, "r"); /* open the file for reading           */
   if (fin == NULL) {
     printf("\nFile %s not found!\n", fname);
@@ -413,11 +631,13 @@ static void cmd_copy(char * par) {
     return;
   }
 
-  total = 0;
-  while ((cnt = fread( & buf, 1, 512, fin)) != 0) {
-    fwrite( & buf, 1, cnt, fout);
-    total += cnt;
-  }
+  /* Timer1 free runs at PCLK (12 MHz) as the time base. */
+  PCONP |= (1 << 2);
+  T1PR = 0;
+  T1TCR = 1;
+  ticks = 0;
+  copy_out = fout;
+  total = file_stream(fin, fname, copy_put, & ticks);
   fclose(fin); /* close input file when done          */
 
   if (merge == __TRUE) {
@@ -425,16 +645,178 @@ static void cmd_copy(char * par) {
     if (fin == NULL) {
       printf("\nFile %s not found!\n", fmer);
     } else {
-      while ((cnt = fread( & buf, 1, 512, fin)) != 0) {
-        fwrite( & buf, 1, cnt, fout);
-        total += cnt;
-      }
+      total += file_stream(fin, fmer, copy_put, & ticks);
       fclose(fin);
     }
   }
-  fclose(fout);
-  dot_format(total, & buf[0]);
-  printf("\n%s bytes copied.\n", & buf[0]);
+  ms = T1TC;
+  fclose(fout); /* writes out what FlashFS still holds */
+  ticks += T1TC - ms;
+  show_rate(total, "copied", ticks);
+}
+
+/*----------------------------------------------------------------------------
+ *        Pass file 'fin' to 'put' through the audio ring, idle while the
+ *        console runs. When the file lies in a few extents, its sectors
+ *        come from the card by DMA into the two ring halves, one cluster
+ *        at most each. The read of the next half is queued before 'put'
+ *        gets the last one, so it runs behind the CRC of SUM. COPY gains
+ *        nothing from it: the card has one data bus, and every FlashFS
+ *        command waits for the queue to drain, so the reads and writes of
+ *        a COPY follow each other. Stdio reads the rest of other files,
+ *        and of any file after a read error. Stops when 'put' fails,
+ *        returns the bytes passed.
+ *---------------------------------------------------------------------------*/
+static U32 file_stream(FILE * fin, char * fname, BOOL( * put)(U8 * p, U32 n), U64 * ticks) {
+  U8 * buf = (U8 * ) AUD_RING_ADDR;
+  U8 * src;
+  U32 sects, n, t, now, total;
+
+  sects = AUD_SEG_CNT * AUD_SEG_BYTES / 2 / 512; /* half the ring */
+  if (blk_spc && blk_spc < sects) {
+    sects = blk_spc;
+  }
+  total = 0;
+  t = T1TC;
+  if (raw_open(fname)) {
+    raw_buf(buf, sects);
+    raw_seek(0);
+    while ((src = raw_get( & n)) != NULL) {
+      if (!put(src, n)) {
+        raw_close();
+        return (total);
+      }
+      raw_used(n);
+      total += n;
+      now = T1TC; /* summed up per chunk, Timer1 wraps in minutes */
+      * ticks += now - t;
+      t = now;
+    }
+    raw_close();
+    fseek(fin, total, SEEK_SET);
+  }
+  while ((n = fread(buf, 1, AUD_SEG_CNT * AUD_SEG_BYTES, fin)) != 0) {
+    if (!put(buf, n)) {
+      break;
+    }
+    total += n;
+    now = T1TC;
+    * ticks += now - t;
+    t = now;
+  }
+  return (total);
+}
+
+/*----------------------------------------------------------------------------
+ *        file_stream() sinks of COPY and SUM
+ *---------------------------------------------------------------------------*/
+static BOOL copy_put(U8 * p, U32 n) {
+  return (fwrite(p, 1, n, copy_out) == n);
+}
+
+static BOOL sum_put(U8 * p, U32 n) {
+  sum_crc = crc_calc(sum_crc, p, n);
+  return (__TRUE);
+}
+
+/*----------------------------------------------------------------------------
+ *        Build the CRC-32 (IEEE 802.3, reflected) tables for slicing by 4:
+ *        crc_tab[k][i] is the CRC of byte i followed by k zero bytes.
+ *---------------------------------------------------------------------------*/
+static void crc_init(void) {
+  U32 i, k, c;
+
+  for (i = 0; i < 256; i++) {
+    c = i;
+    for (k = 0; k < 8; k++) {
+      c = (c & 1) ? (c >> 1) ^ 0xEDB88320 : c >> 1;
+    }
+    crc_tab[0][i] = c;
+  }
+  for (i = 0; i < 256; i++) {
+    c = crc_tab[0][i];
+    for (k = 1; k < 4; k++) {
+      c = (c >> 8) ^ crc_tab[0][c & 0xFF];
+      crc_tab[k][i] = c;
+    }
+  }
+}
+
+/*----------------------------------------------------------------------------
+ *        Continue 'crc' over 'n' bytes at 'p'. The aligned middle goes a
+ *        word at a time, four table loads per word: the tables take 4 KB
+ *        of local RAM, single cycle on the ARM7 where flash is not.
+ *---------------------------------------------------------------------------*/
+static U32 crc_calc(U32 crc, const U8 * p, U32 n) {
+  const U32 * wp;
+
+  crc = ~crc;
+  for (; n && ((unsigned long) p & 3); n--) {
+    crc = (crc >> 8) ^ crc_tab[0][(crc ^ * p++) & 0xFF];
+  }
+  for (wp = (const U32 * ) p; n >= 4; n -= 4) {
+    crc ^= * wp++; /* little endian: low byte comes first */
+    crc = crc_tab[3][crc & 0xFF] ^ crc_tab[2][(crc >> 8) & 0xFF] ^
+      crc_tab[1][(crc >> 16) & 0xFF] ^ crc_tab[0][crc >> 24];
+  }
+  for (p = (const U8 * ) wp; n; n--) {
+    crc = (crc >> 8) ^ crc_tab[0][(crc ^ * p++) & 0xFF];
+  }
+  return (~crc);
+}
+
+/*----------------------------------------------------------------------------
+ *        CRC-32 of file 'fname', its length to 'size'; prints the CRC and
+ *        the read rate. Returns the CRC, 'size' is ~0 when not found.
+ *---------------------------------------------------------------------------*/
+static U32 sum_file(char * fname, U32 * size) {
+  FILE * f;
+  U64 ticks;
+
+  * size = ~0u;
+  f = fopen(fname, "r");
+  if (f == NULL) {
+    printf("\nFile %s not found!\n", fname);
+    return (0);
+  }
+  /* Timer1 free runs at PCLK (12 MHz) as the time base. */
+  PCONP |= (1 << 2);
+  T1PR = 0;
+  T1TCR = 1;
+  ticks = 0;
+  sum_crc = 0;
+  * size = file_stream(f, fname, sum_put, & ticks);
+  fclose(f);
+  printf("\nCRC32 %08X  %s", sum_crc, fname);
+  show_rate( * size, "checked", ticks);
+  return (sum_crc);
+}
+
+/*----------------------------------------------------------------------------
+ *        CRC-32 of a file, or compare two files by length and CRC
+ *---------------------------------------------------------------------------*/
+static void cmd_sum(char * par) {
+  char * fname, * fcmp, * next;
+  U32 crc, size, size2;
+
+  fname = get_entry(par, & next);
+  if (fname == NULL) {
+    printf("\nFilename missing.\n");
+    return;
+  }
+  fcmp = get_entry(next, & next);
+  if (crc_tab[0][1] == 0) {
+    crc_init();
+  }
+  crc = sum_file(fname, & size);
+  if (fcmp == NULL || size == ~0u) {
+    return;
+  }
+  if (sum_file(fcmp, & size2) == crc && size2 == size) {
+    printf("\nFiles match.\n");
+  } else if (size2 != ~0u) {
+    printf("\nFiles differ.\n");
+  }
 }
 
 /*----------------------------------------------------------------------------
@@ -474,61 +856,81 @@ static void cmd_delete(char * par) {
  *---------------------------------------------------------------------------*/
 static void cmd_dir(char * par) {
   U64 fsize;
-  U32 files, dirs, i;
-  char temp[32], * mask, * next, ch;
-  FINFO info;
-
-  mask = get_entry(par, & next);
-  if (mask == NULL) {
-    mask = "*.*";
+  U32 files, dirs, order, lines, i;
+  char temp[32], * mask, * next, * opt;
+  BOOL page;
+  DIR_ENT * e;
+
+  mask = "*.*";
+  order = DIR_BY_DIR;
+  page = __FALSE;
+  for (opt = get_entry(par, & next); opt != NULL; opt = get_entry(next, & next)) {
+    if (opt[0] != '/') {
+      mask = opt;
+      continue;
+    }
+    switch (toupper(opt[1])) {
+      case 'N':
+        order = DIR_BY_NAME;
+        break;
+      case 'S':
+        order = DIR_BY_SIZE;
+        break;
+      case 'D':
+        order = DIR_BY_TIME;
+        break;
+      case 'P':
+        page = __TRUE;
+        break;
+      default:
+        printf("\nCommand error.\n");
+        return;
+    }
   }
 
   printf("\nFile System Directory...");
+  if (!dir_open(mask, order)) {
+    printf("\nPath too long to sort, in directory order:");
+  }
   files = 0;
   dirs = 0;
   fsize = 0;
-  info.fileID = 0;
-  while (ffind(mask, & info) == 0) {
-    if (info.attrib & ATTR_DIRECTORY) {
-      i = 0;
-      while (strlen((const char * ) info.name + i) > 41) {
-        ch = info.name[i + 41];
-        info.name[i + 41] = 0;
-        printf("\n%-41s", & info.name[i]);
-        info.name[i + 41] = ch;
-        i += 41;
-      }
-      printf("\n%-41s    <DIR>       ", & info.name[i]);
-      printf("  %02d.%02d.%04d  %02d:%02d",
-        info.time.day, info.time.mon, info.time.year,
-        info.time.hr, info.time.min);
+  lines = 0;
+  while ((e = dir_next()) != NULL) {
+    for (i = 0; e->len - i > 41; i += 41) {
+      printf("\n%.41s", & e->name[i]);
+      lines++;
+    }
+    if (e->attrib & ATTR_DIRECTORY) {
+      printf("\n%-41s    <DIR>       ", & e->name[i]);
       dirs++;
     } else {
-      dot_format(info.size, & temp[0]);
-      i = 0;
-      while (strlen((const char * ) info.name + i) > 41) {
-        ch = info.name[i + 41];
-        info.name[i + 41] = 0;
-        printf("\n%-41s", & info.name[i]);
-        info.name[i + 41] = ch;
-        i += 41;
-      }
-      printf("\n%-41s %14s ", & info.name[i], temp);
-      printf("  %02d.%02d.%04d  %02d:%02d",
-        info.time.day, info.time.mon, info.time.year,
-        info.time.hr, info.time.min);
-      fsize += info.size;
+      dot_format(e->size, & temp[0]);
+      printf("\n%-41s %14s ", & e->name[i], temp);
+      fsize += e->size;
       files++;
     }
+    printf("  %02d.%02d.%04d  %02d:%02d",
+      (e->time >> 16) & 0x1F, (e->time >> 21) & 0x0F, (e->time >> 25) + 1980,
+      (e->time >> 11) & 0x1F, (e->time >> 5) & 0x3F);
+    if (page && ++lines >= DIR_PAGE) {
+      printf("\n-- Press a key for more, ESC to stop --");
+      if (getkey() == ESC) {
+        printf("\n");
+        return;
+      }
+      printf("\r%39s\r", "");
+      lines = 0;
+    }
   }
-  
-  if (info.fileID == 0) {
+
+  if (files + dirs == 0) {
     printf("\nNo files...");
   } else {
     dot_format(fsize, & temp[0]);
     printf("\n              %9d File(s)    %21s bytes", files, temp);
   }
-  dot_format(ffree(""), & temp[0]);
+  dot_format(blk_free(), & temp[0]);
   if (dirs) {
     printf("\n              %9d Dir(s)     %21s bytes free.\n", dirs, temp);
   } else {
@@ -575,236 +977,638 @@ static void cmd_help(char * par) {
   printf(help);
 }
 
-static void cmd_play(char * par) {
-
-  char * fname, * next;
-  int wi = 0;
-  int ch;
-  long long int i = 0;
-  int stat = 1;
-  unsigned long long int temp = 0;
-  char head[] = "RIFF";
-  const char head2[] = "WAVE";
-  const char head3[] = "fmt ";
-  const char head4[] = "data";
+/*----------------------------------------------------------------------------
+ *        Read wave data into free ring segments, 'left' bytes remain
+ *---------------------------------------------------------------------------*/
+static void play_fill(U64 * left, U32 frame) {
+  U8 * bp, * src = NULL;
+  U32 n, m;
 
-  printf("Playing file");
-  fname = get_entry(par, & next);
-  if (fname == NULL) {
-    printf("\nFilename missing.\n");
-    return;
+  while ( * left && (bp = aud_ring_get( & n)) != NULL) {
+    if ( * left < n) {
+      n = (U32)( * left);
+    }
+    if (play_raw && (src = raw_get( & m)) == NULL) {
+      /* Read error or short file: stdio goes on from here. */
+      play_raw = __FALSE;
+      fseek(curAudio.f, curAudio.dataOffset + (U32) curAudio.curPos, SEEK_SET);
+    }
+    if (play_raw) {
+      n = (n > m) ? m : n; /* up to the end of the card buffer     */
+    } else {
+      n = fread(bp, 1, n, curAudio.f);
+    }
+    n -= n % frame; /* whole sample frames only             */
+    if (n == 0) {
+      * left = 0; /* end of file reached                  */
+      break;
+    }
+    if (play_raw) {
+      aud_ring_cvt(src, n); /* converted from the DMA buffer        */
+      raw_used(n);
+    } else {
+      aud_ring_put(n); /* converted to DAC words here          */
+    }
+    curAudio.curPos += n;
+    * left -= n;
+    AD0CR |= 0x01000000; /* Start A/D Conversion               */
   }
-  printf("\nRead data from file %s\n", fname);
+}
 
-  curAudio.vol = 2;
+/*----------------------------------------------------------------------------
+ *        Sample frame of the current file now at the DAC
+ *---------------------------------------------------------------------------*/
+static U32 play_pos(U32 frame) {
+  U32 pos, q;
 
-  curAudio.f = fopen(fname, "r"); /* open the file for reading           */
-  if (curAudio.f == NULL) {
-    printf("\nFile not found!\n");
-    return;
-  }
+  pos = (U32)(curAudio.curPos / frame);
+  q = aud_ring_queued();
+  return ((pos > q) ? pos - q : 0);
+}
 
-  while (i < 4 && stat == 1) {
+/*----------------------------------------------------------------------------
+ *        Show the play time on the second LCD line, once a second
+ *---------------------------------------------------------------------------*/
+static void play_time(U32 frame) {
+  char buf[8];
+  U32 sec;
 
-    ch = fgetc(curAudio.f);
-    if (ch != head[i])
-      stat = 0;
-    i++;
+  sec = play_pos(frame) / (U32)curAudio.sampleRate;
+  if (sec == play_sec) {
+    return;
   }
-
-  i = 0;
-
-  curAudio.readSize = 0;
-  while (i < 4 && stat == 1) {
-    temp = fgetc(curAudio.f);
-    temp = temp << (i * 8);
-    curAudio.totSize += temp;
-    i++;
+  play_sec = sec;
+  if (sec > 99 * 60 + 59) {
+    sec = 99 * 60 + 59; /* the field has two digits of minutes  */
   }
-  temp = 0;
+  sprintf(buf, "%2d:%02d", sec / 60, sec % 60);
+  VICIntEnClr = (1 << 17); /* EINT3 writes the LCD too            */
+  set_cursor(0, 1);
+  lcd_print((unsigned char * ) buf);
+  VICIntEnable = (1 << 17);
+}
 
-  printf("\n%lli\n", curAudio.totSize);
-  i = 0;
+/*----------------------------------------------------------------------------
+ *        Move playback by 'ms' milliseconds from the sample now at the DAC
+ *        and refill the ring from there. 'mark' is the clock of the request.
+ *---------------------------------------------------------------------------*/
+static void play_seek(S32 ms, U32 mark, U64 * left, U32 frame) {
+  U32 total, pos;
+  S64 tgt;
+
+  total = (U32)(curAudio.readSize / frame);
+  pos = play_pos(frame);
+
+  /* Whole sample frames keep the data chunk block aligned. */
+  tgt = (S64)pos + ((S64)ms * curAudio.sampleRate) / 1000;
+  if (tgt < 0) {
+    tgt = 0;
+  } else if (tgt > total) {
+    tgt = total;
+  }
+  /* Whole words too, so the kernels start on word loads at once. */
+  tgt -= tgt % (4 / frame);
+
+  curAudio.eof = 1; /* ring runs dry until refilled, no underrun */
+  aud_ring_drop((curAudio.stat & 1) ? mark : 0);
+  if (play_raw) {
+    raw_seek(curAudio.dataOffset + (U32)tgt * frame);
+  } else if (fseek(curAudio.f, curAudio.dataOffset + (U32)tgt * frame, SEEK_SET) != 0) {
+    tgt = total;
+  }
+  curAudio.curPos = (U32)tgt * frame;
+  * left = curAudio.readSize - curAudio.curPos;
+  play_fill(left, frame);
+  curAudio.eof = 0;
+}
 
-  while (i < 4 && stat == 1) {
+/*----------------------------------------------------------------------------
+ *        Open a wave file as curAudio.f and take over its format. 'known'
+ *        is the format from the track index, NULL to parse the header.
+ *---------------------------------------------------------------------------*/
+static BOOL play_open(char * fname, const AUD_FMT * known) {
+  FILE * f;
+  AUD_FMT fmt;
+  U32 stat;
 
-    ch = fgetc(curAudio.f);
-    if (ch != head2[i])
-      stat = 0;
-    putchar(ch);
-    i++;
+  printf("\nRead data from file %s\n", fname);
+  f = fopen(fname, "r"); /* open the file for reading           */
+  if (f == NULL) {
+    printf("\nFile not found!\n");
+    return (__FALSE);
   }
-  i = 0;
-  while (i < 4 && stat == 1) {
 
-    ch = fgetc(curAudio.f);
-    if (ch != head3[i])
-      stat = 0;
-    putchar(ch);
-    i++;
+  if (known != NULL) {
+    fmt = * known;
+    stat = (fseek(f, fmt.data_off, SEEK_SET) == 0) ? AUD_WAV_OK : AUD_WAV_NO_DATA;
+  } else {
+    stat = aud_parse(f, & fmt);
   }
-
-  if (stat == 0) {
+  if (stat == AUD_WAV_NOT_RIFF) {
     printf("\nNot Wave File\n");
-    fclose(curAudio.f);
-    return;
+  } else if (stat != AUD_WAV_OK) {
+    printf("\nWave file has no %s chunk\n", (stat == AUD_WAV_NO_FMT) ? "fmt" : "data");
+  } else if (fmt.tag != 1) {
+    printf("\nFormat %d is not PCM, some compression\n", fmt.tag);
+    stat = 1;
+  } else if ((fmt.channels != 1 && fmt.channels != 2) ||
+             (fmt.bits != 8 && fmt.bits != 16) || fmt.rate == 0) {
+    printf("\nUnsupported format: %d channels, %d bit\n", fmt.channels, fmt.bits);
+    stat = 1;
   }
-  i = 0;
-  curAudio.Subchunk1Size = 0;
-  while (i < 4) {
-    temp = fgetc(curAudio.f);
-    curAudio.Subchunk1Size += (temp << (8 * i));
-    i++;
-  }
-
-  printf("\nChunkSize = %lli\n", curAudio.Subchunk1Size);
-  if (curAudio.Subchunk1Size != 16)
-    printf("/nThis is not PCM, not sure how to proceed\n");
-
-  i = 0;
-  curAudio.PCM = 0;
-  while (i < 2) {
-    temp = fgetc(curAudio.f);
-    curAudio.PCM += (temp << (8 * i));
-    i++;
-  }
-
-  printf("\nPCM = %li\n", curAudio.PCM);
-  if (curAudio.PCM != 1)
-    printf("/nThis is not PCM = 1, not sure how to proceed, some compression\n");
-
-  i = 0;
-  curAudio.numChannels = 0;
-  while (i < 2) {
-    temp = fgetc(curAudio.f);
-    curAudio.numChannels += (temp << (8 * i));
-    i++;
-  }
-
-  printf("\nNumber of Channels = %li\n", curAudio.numChannels);
-  if (curAudio.numChannels == 1) {
-    curAudio.md = 0;
-  } else if (curAudio.numChannels == 2) {
-    printf("This is Dual channel, weird output will occur\n");
-    curAudio.md = 1;
-  }
-
-  i = 0;
-  curAudio.sampleRate = 0;
-  while (i < 4) {
-    temp = fgetc(curAudio.f);
-    curAudio.sampleRate += (temp << (8 * i));
-    i++;
-  }
-  printf("\nSample Rate = %lli\n", curAudio.sampleRate);
-
-  i = 0;
-  while (i < 6) {
-    ch = fgetc(curAudio.f);
-    putchar(ch);
-    i++;
-  }
-
-  i = 0;
-  curAudio.sampleSize = 0;
-  while (i < 2) {
-    temp = fgetc(curAudio.f);
-    curAudio.sampleSize += (temp << (8 * i));
-    i++;
-  }
-  printf("\nSample Size = %li\n", curAudio.sampleSize);
-  if (curAudio.sampleSize == 16)
-    curAudio.md |= 2;
-  else if (curAudio.sampleSize != 8) {
-    printf("breaking, unknown sample size");
-    return;
+  if (stat != AUD_WAV_OK) {
+    fclose(f);
+    return (__FALSE);
   }
 
-  i = 0;
-  while (i < 4 && stat == 1) {
+  curAudio.f = f;
+  curAudio.PCM = fmt.tag;
+  curAudio.numChannels = fmt.channels;
+  curAudio.sampleRate = fmt.rate;
+  curAudio.sampleSize = fmt.bits;
+  curAudio.readSize = fmt.data_len;
+  curAudio.curPos = 0;
+  curAudio.dataOffset = fmt.data_off;
+  curAudio.md = ((fmt.channels == 2) ? 1 : 0) | ((fmt.bits == 16) ? 2 : 0);
+
+  printf("%li ch, %lli Hz, %li bit, %lli bytes\n", curAudio.numChannels,
+    curAudio.sampleRate, curAudio.sampleSize, curAudio.readSize);
+
+  /* A file in few extents is read past FlashFS, converted from the card
+     buffers. The conversion needs the samples word aligned.           */
+  play_raw = __FALSE;
+  if ((fmt.data_off & 3) == 0 && (stat = raw_open(fname)) != 0) {
+    play_raw = __TRUE;
+    raw_seek(fmt.data_off);
+    printf("Raw sector reads, %d extent%s\n", stat, (stat > 1) ? "s" : "");
+  }
+#if AUD_SRC
+  if (curAudio.sampleRate != AUD_SRC_RATE) {
+    printf("Resampling to %d Hz\n", AUD_SRC_RATE);
+  }
+#endif
+  return (__TRUE);
+}
 
-    ch = fgetc(curAudio.f);
-    if (ch != head4[i]) {
-      i = 0;
-      continue;
+/*----------------------------------------------------------------------------
+ *        Open the next playable file of a playlist, from the track index
+ *        when it is open, else from a directory search
+ *---------------------------------------------------------------------------*/
+static BOOL play_open_next(void) {
+  DIR_ENT * e;
+  TRK_REC rec;
+
+  if (play_idx) {
+    while (trk_next( & rec)) {
+      if (play_open(rec.name, & rec.fmt)) {
+        return (__TRUE);
+      }
     }
-    putchar(ch);
-    i++;
+    return (__FALSE);
   }
-
-  if (stat == 0) {
-    printf("\nSomething wrong happend\n");
-    fclose(curAudio.f);
-    return;
+  while ((e = dir_next()) != NULL) {
+    if ((e->attrib & ATTR_DIRECTORY) == 0 && play_open(e->name, NULL)) {
+      return (__TRUE);
+    }
   }
+  return (__FALSE);
+}
 
-  curAudio.readSize = 0;
-  i = 0;
-  head[0] = 0;
-  head[1] = 0;
-  head[2] = 0;
-  head[3] = 0;
-
-  while (i < 4) {
-    head[i] = fgetc(curAudio.f);
-    printf("%i\n", head[i]);
-    i++;
+/*----------------------------------------------------------------------------
+ *        Play file 'fname', or all files matching 'mask' without gaps
+ *---------------------------------------------------------------------------*/
+static void play_list(char * fname, char * mask) {
+  U64 left;
+  U32 frame, rate, scan, next;
+  S32 step;
+  BOOL more;
+
+  memset(&blk_stat, 0, sizeof(blk_stat));
+  more = (mask != NULL);
+  if (more) {
+    play_idx = trk_open(mask);
+    if (!play_idx) {
+      dir_open(mask, DIR_BY_DIR);
+    }
+    if (!play_open_next()) {
+      printf("\nNo files...\n");
+      trk_close();
+      return;
+    }
+  } else if (!play_open(fname, NULL)) {
+    return;
   }
 
-  curAudio.readSize = (U64)(head[0]) + ((U64)(head[1]) << 8) + ((U64)(head[2]) << 16) + ((U64)(head[3]) << 24);
-  printf("\nTo Read %lli Bytes now\n", curAudio.readSize);
-
   //WE HAVE TO SET DAC FOR PUTTING OUT ALARMS
   PINSEL1 |= 0x200000;
 
-  curAudio.curPos = 0;
+  /* Prime the ring buffer before the first sample is due. */
+  aud_ring_reset();
+  curAudio.eof = 0;
+  left = curAudio.readSize;
+  frame = ((curAudio.md & 1) ? 2 : 1) * ((curAudio.md & 2) ? 2 : 1);
+  play_fill(&left, frame);
 
   /* Enable and setup timer interrupt, start timer                            */
-  T0MR0 = (12000000 / curAudio.sampleRate) - 1; /* 1msec = 12000-1 at 12.0 MHz , made it x1000 for seconds*/
-  //T0MR0 = 1499;
-  T0TCR = 1; /* Timer0 Enable               */
+  rate = aud_out_rate(curAudio.sampleRate);
+  aud_start(curAudio.sampleRate);
 
-  VICIntEnable = (1 << 4); /* Enable Timer0 Interrupt     */
-
-  curAudio.pos = 0;
-  //curAudio.buf = 1;
-  curAudio.swi = 1;
-  temp = curAudio.readSize;
-  stat = 0;
-  
-  
   curAudio.stat = 1;
+  play_sec = 0xFFFFFFFF;
+  scan = 0;
+  step = 0;
+  next = 0;
   
-  
-  while (temp && (curAudio.stat&2) == 0) {
-    if (curAudio.swi == 1) {
-      VICIntEnClr = (1 << 4);
-      i = fread(curAudio.bufrs, 1, MEM_LEN, curAudio.f);
-      temp -= i;
-      curAudio.swi = 0;
-      curAudio.pos = 0;
-      AD0CR |= 0x01000000; /* Start A/D Conversion               */
-      VICIntEnable = (1 << 4);
+  while ((curAudio.stat&2) == 0) {
+    if (curAudio.stat & (4+8)) {
+      /* FORW/BACK pressed: jump one step, more follow while it is held. */
+      scan = (curAudio.stat & 4) ? FORW : BACK;
+      curAudio.stat &= ~(4+8);
+      step = (scan == FORW) ? SEEK_STEP_MS : -SEEK_STEP_MS;
+      next = curAudio.seekAt;
+      play_seek(step, next, &left, frame);
+      next += SEEK_REPEAT_MS * rate / 1000;
+    } else if (scan && (FIO2PIN & scan) == 0 &&
+               (S32)(curAudio.ring.clock - next) >= 0) {
+      /* Still held: scan on in growing steps. */
+      if (step < SEEK_MAX_MS && step > -SEEK_MAX_MS) {
+        step *= 2;
+      }
+      play_seek(step, next, &left, frame);
+      next += SEEK_REPEAT_MS * rate / 1000;
+    }
 
+    /* Top up the ring, the ISR keeps consuming meanwhile. */
+    play_fill(&left, frame);
+    play_time(frame);
+    if (left) {
+      continue;
     }
-    
-    if (curAudio.curPos >= curAudio.readSize) {
-      break;
+
+    if (more) {
+      /* The file is read to its end while the ring still holds its tail.
+         Open the next track now and queue its data right behind it.     */
+      printf("%lli   %lli\n", curAudio.curPos, curAudio.readSize);
+      fclose(curAudio.f);
+      curAudio.f = NULL;
+      more = play_open_next();
+      if (more) {
+        if (aud_out_rate(curAudio.sampleRate) != rate) {
+          /* Timer rate changes, this needs the ring played out first. */
+          while (!aud_ring_flush());
+          curAudio.eof = 1;
+          while (!aud_ring_empty() && (curAudio.stat&2) == 0);
+          aud_stop();
+          curAudio.eof = 0;
+          aud_ring_reset();
+          left = curAudio.readSize;
+          frame = ((curAudio.md & 1) ? 2 : 1) * ((curAudio.md & 2) ? 2 : 1);
+          play_fill(&left, frame); /* primed again, as for the first file */
+          rate = aud_out_rate(curAudio.sampleRate);
+          aud_start(curAudio.sampleRate);
+          continue;
+        }
+        while (!aud_ring_next() && (curAudio.stat&2) == 0);
+        left = curAudio.readSize;
+        frame = ((curAudio.md & 1) ? 2 : 1) * ((curAudio.md & 2) ? 2 : 1);
+        continue;
+      }
     }
 
+    if (aud_ring_flush()) {
+      curAudio.eof = 1;
+      if (aud_ring_empty()) {
+        break;
+      }
+    }
   }
 
   printf("%lli   %lli\n", curAudio.curPos, curAudio.readSize);
+  printf("Underruns: %d  Overruns: %d\n", curAudio.ring.underrun,
+    curAudio.ring.overrun);
+  if (curAudio.ring.seeks) {
+    /* Press to first sample of the new position, against the time the
+       full ring takes to play.                                          */
+    printf("Seeks: %d  max latency %d us, buffer %d us\n", curAudio.ring.seeks,
+      (int)(((U64)curAudio.ring.seek_max * 1000000) / rate),
+      (int)(((U64)AUD_SEG_CNT * AUD_SEG_WORDS * 1000000) / rate));
+  }
+  if (blk_stat.hits + blk_stat.misses) {
+    printf("Read-ahead: %d of %d sectors, %d read ahead\n", blk_stat.hits,
+      blk_stat.hits + blk_stat.misses, blk_stat.ahead);
+  }
+#if AUD_PROFILE
+  if (curAudio.ring.prof_cnt) {
+    /* Timer1 ticks at PCLK, one tick is 4 CPU cycles. */
+    printf("Handler cost: %d cycles/sample\n",
+      (int)(((U64)curAudio.ring.prof_ticks * 4) / curAudio.ring.prof_cnt));
+  }
+  if (curAudio.ring.cvt_cnt) {
+    printf("Convert cost: %d cycles/sample\n",
+      (int)(((U64)curAudio.ring.cvt_ticks * 4) / curAudio.ring.cvt_cnt));
+  }
+#endif
   
+  raw_close();
+  play_raw = __FALSE;
   clearAudData();
+  trk_close();
+  play_idx = __FALSE;
   
   printf("\nFile closed.\n");
+}
+
+/*----------------------------------------------------------------------------
+ *        Play a wave file
+ *---------------------------------------------------------------------------*/
+static void cmd_play(char * par) {
+  char * fname, * next;
 
+  printf("Playing file");
+  fname = get_entry(par, & next);
+  if (fname == NULL) {
+    printf("\nFilename missing.\n");
+    return;
+  }
+  curAudio.vol = 2;
+  curAudio.f = NULL;
+  play_list(fname, NULL);
 }
+
+/*----------------------------------------------------------------------------
+ *        Play all wave files matching a mask, one after the other
+ *---------------------------------------------------------------------------*/
+static void cmd_playall(char * par) {
+  char * mask, * next;
+
+  mask = get_entry(par, & next);
+  if (mask == NULL) {
+    mask = "*.WAV";
+  }
+  printf("Playing %s", mask);
+  curAudio.vol = 2;
+  curAudio.f = NULL;
+  play_list(NULL, mask);
+}
+
+/*----------------------------------------------------------------------------
+ *        Rebuild the track index
+ *---------------------------------------------------------------------------*/
+static void cmd_index(char * par) {
+  char * mask, * next;
+  TRK_REC rec;
+  U32 cnt, msec;
+
+  mask = get_entry(par, & next);
+  if (mask == NULL) {
+    mask = "*.WAV";
+  }
+  printf("\nIndexing %s\n", mask);
+  cnt = trk_build(mask);
+  if (cnt == TRK_NO_INDEX) {
+    printf("Names of %d characters and more, PLAYALL walks the directory\n",
+      TRK_NAME_LEN);
+    return;
+  }
+  msec = 0;
+  if (cnt && trk_open(mask)) {
+    while (trk_next( & rec)) {
+      printf("%-31s %5d Hz %2d bit %d ch %4d.%03d s\n", rec.name, rec.fmt.rate,
+        rec.fmt.bits, rec.fmt.channels, rec.msec / 1000, rec.msec % 1000);
+      msec += rec.msec;
+    }
+    trk_close();
+  }
+  printf("%d track(s), %d:%02d total\n", cnt, msec / 60000, (msec / 1000) % 60);
+}
+
+/*----------------------------------------------------------------------------
+ *        Measure card throughput and latency, through the file system and
+ *        at the sector level below it
+ *---------------------------------------------------------------------------*/
+static void cmd_bench(char * par) {
+  static const char * const name[] = {
+    "stdio seq write", "stdio seq read", "stdio rnd write", "stdio rnd read",
+    "sect  seq write", "sect  seq read", "sect  rnd write", "sect  rnd read"
+  };
+  static BENCH_RES r;
+  Media_INFO info;
+  char * next;
+  U8 * buf;
+  U32 bsz[3], i, n, t, test, cnt, base, kbs, erased;
+  int kb = 512;
+
+  par = get_entry(par, & next);
+  if (par != NULL && (sscanf(par, "%d", & kb) == 0 || kb <= 0)) {
+    printf("\nCommand error.\n");
+    return;
+  }
+
+  /* Timer1 free runs at PCLK (12 MHz) as the time base. The data buffer
+     is the audio ring, idle while the console runs and in DMA reach.   */
+  PCONP |= (1 << 2);
+  T1PR = 0;
+  T1TCR = 1;
+  buf = (U8 * ) AUD_RING_ADDR;
+  for (i = 0; i < AUD_SEG_CNT * AUD_SEG_BYTES; i++) {
+    buf[i] = (U8) i;
+  }
+
+  /* A sector, 4 KB and a cluster, as far as the ring holds it. */
+  n = 0;
+  bsz[n++] = 512;
+  bsz[n++] = 4096;
+  i = blk_spc ? blk_spc * 512 : 8192;
+  if (i > AUD_SEG_CNT * AUD_SEG_BYTES) {
+    i = AUD_SEG_CNT * AUD_SEG_BYTES;
+  }
+  if (i > 4096) {
+    bsz[n++] = i;
+  }
+
+  /* Sector tests write back what they read, in the second card half. */
+  info.block_cnt = 0;
+  mc0_drv.ReadInfo( & info);
+  base = (info.block_cnt / 2) & ~0xFF;
+
+  printf("\n%d KB per test", kb);
+  if (blk_spc) {
+    printf(", cluster %d bytes", blk_spc * 512);
+  }
+  printf("\n");
+  printf("Test             Size    MB/s  min us  avg us  p99 us  max us\n");
+  erased = blk_stat.erased;
+  for (i = 0; i < n; i++) {
+    cnt = ((U32) kb * 1024) / bsz[i];
+    for (test = 0; test < 8; test++) {
+      if ((test & BENCH_SECT) && base + cnt * (bsz[i] / 512) > info.block_cnt) {
+        continue; /* no card behind mc0_drv, or too small */
+      }
+      if (!bench_run(test, bsz[i], cnt, base, & r) || r.ops == 0) {
+        printf("%-16s %5d  not done\n", name[test], bsz[i]);
+        continue;
+      }
+      t = r.sum + r.close;
+      kbs = (U32)(((U64) r.ops * bsz[i] * 12000000 / 1024) / (t ? t : 1));
+      /* Timer1 ticks to microseconds: 12 per us. */
+      printf("%-16s %5d %3d.%02d %7d %7d %7d %7d\n", name[test], bsz[i],
+        kbs / 1024, (kbs % 1024) * 100 / 1024, r.min / 12, r.sum / r.ops / 12,
+        bench_pct( & r, 99) / 12, r.max / 12);
+    }
+  }
+  fdelete("BENCH.TMP");
+  if (base == 0) {
+    printf("No sector tests, the card size is not known\n");
+  }
+  if (blk_stat.erased != erased) {
+    printf("Pre-erased: %d sectors\n", blk_stat.erased - erased);
+  }
+  if (mci_wr_stat.errors) {
+    printf("Write errors: %d, last at block %d\n", mci_wr_stat.errors,
+      mci_wr_stat.err_blk);
+  }
+}
+
+/*----------------------------------------------------------------------------
+ *        BENCH: one test of 'cnt' transfers of 'size' bytes. Sector tests
+ *        start at card sector 'base'. Random positions come from a fixed
+ *        sequence, so that runs compare.
+ *---------------------------------------------------------------------------*/
+static BOOL bench_run(U32 test, U32 size, U32 cnt, U32 base, BENCH_RES * r) {
+  static const char * const mode[] = { "w", "r", "r+", "r" };
+  U8 * buf = (U8 * ) AUD_RING_ADDR;
+  FILE * f = NULL;
+  U32 i, pos, sect, n, t0, rnd;
+  BOOL ok = __TRUE;
+
+  memset(r, 0, sizeof( * r));
+  r->min = 0xFFFFFFFF;
+  if (!(test & BENCH_SECT)) {
+    f = fopen("BENCH.TMP", mode[test & 3]);
+    if (f == NULL) {
+      return (__FALSE);
+    }
+  }
+  n = size / 512;
+  rnd = 1;
+  for (i = 0; i < cnt && ok; i++) {
+    pos = i;
+    if (test & BENCH_RND) {
+      rnd = rnd * 1103515245 + 12345;
+      pos = (rnd >> 8) % cnt;
+    }
+    if (test & BENCH_SECT) {
+      sect = base + pos * n;
+      if (!(test & BENCH_RD) && !mc0_drv.ReadSect(sect, buf, n)) {
+        ok = __FALSE; /* the data to write back          */
+        break;
+      }
+      t0 = T1TC;
+      ok = (test & BENCH_RD) ? mc0_drv.ReadSect(sect, buf, n) :
+        mc0_drv.WriteSect(sect, buf, n);
+    } else {
+      t0 = T1TC;
+      if (test & BENCH_RND) {
+        ok = (fseek(f, pos * size, SEEK_SET) == 0);
+      }
+      if (ok) {
+        ok = ((test & BENCH_RD) ? fread(buf, 1, size, f) :
+          fwrite(buf, 1, size, f)) == size;
+      }
+    }
+    if (ok) {
+      bench_lat(r, T1TC - t0);
+    }
+  }
+  if (f != NULL) {
+    t0 = T1TC;
+    fclose(f); /* the last cluster goes out here     */
+    r->close = T1TC - t0;
+  }
+  return (ok);
+}
+
+/*----------------------------------------------------------------------------
+ *        BENCH: count a transfer time 't'. Buckets 0..3 are single ticks,
+ *        above that each octave is split in four.
+ *---------------------------------------------------------------------------*/
+static void bench_lat(BENCH_RES * r, U32 t) {
+  U32 o, b;
+
+  r->ops++;
+  r->sum += t;
+  if (t < r->min) {
+    r->min = t;
+  }
+  if (t > r->max) {
+    r->max = t;
+  }
+  b = t;
+  if (t >= 4) {
+    for (o = 2; (t >> (o + 1)) != 0; o++);
+    b = (o - 1) * 4 + ((t >> (o - 2)) & 3);
+  }
+  if (b >= LAT_BKT) {
+    b = LAT_BKT - 1;
+  }
+  if (r->hist[b] != 0xFFFF) {
+    r->hist[b]++;
+  }
+}
+
+/*----------------------------------------------------------------------------
+ *        BENCH: transfer time 'pct' percent of the transfers stay within,
+ *        the upper end of its histogram bucket
+ *---------------------------------------------------------------------------*/
+static U32 bench_pct(BENCH_RES * r, U32 pct) {
+  U32 b, o, n, sum, t;
+
+  n = (r->ops * pct + 99) / 100;
+  for (b = sum = 0; b < LAT_BKT - 1; b++) {
+    sum += r->hist[b];
+    if (sum >= n) {
+      break;
+    }
+  }
+  t = b;
+  if (b >= 4) {
+    o = b / 4 + 1;
+    t = ((5 + b % 4) << (o - 2)) - 1;
+  }
+  return ((t < r->max) ? t : r->max);
+}
+
+/*----------------------------------------------------------------------------
+ *        Show the sector cache counters
+ *---------------------------------------------------------------------------*/
+static void cmd_cache(char * par) {
+  static const char * const cls[] = { "Other sectors", "FAT, root dir" };
+  char * next;
+  U32 i, n;
+
+  par = get_entry(par, & next);
+  printf("\nSector cache: %d lines, %s\n", BLK_CACHE_SECTS,
+    BLK_CACHE_SLRU ? "segmented LRU" : "LRU");
+  for (i = 0; i < 2; i++) {
+    n = blk_cstat.hits[i] + blk_cstat.misses[i];
+    printf("%s: %6d hits %6d misses", cls[i], blk_cstat.hits[i],
+      blk_cstat.misses[i]);
+    if (n) {
+      printf(" %3d%% hit rate", (int)(((U64) blk_cstat.hits[i] * 100) / n));
+    }
+    printf("\n");
+  }
+  printf("Lines reused: %d\n", blk_cstat.evicts);
+  if (par != NULL && ((strcmp(par, "/R") == 0) || (strcmp(par, "/r") == 0))) {
+    memset( & blk_cstat, 0, sizeof(blk_cstat));
+  }
+}
+
 /*----------------------------------------------------------------------------
  *        Initialize a Flash Memory Card
  *---------------------------------------------------------------------------*/
 static void init_card(void) {
+  static U32 bus_khz, bus_width;
   U32 retv;
 
   while ((retv = finit(NULL)) != 0) {
@@ -819,14 +1623,24 @@ static void init_card(void) {
       cmd_format( & in_line[0]);
     }
   }
+  /* finit() runs before every command, report the bus when it changes. */
+  if (blk_bus.khz && (blk_bus.khz != bus_khz || blk_bus.width != bus_width)) {
+    bus_khz = blk_bus.khz;
+    bus_width = blk_bus.width;
+    printf("\nSD bus: %d-bit, %d kHz%s, read %d.%02d MB/s\n", blk_bus.width,
+      blk_bus.khz, blk_bus.hs ? ", high speed" : "", blk_bus.rd_kbs / 1024,
+      (blk_bus.rd_kbs % 1024) * 100 / 1024);
+  }
 }
 
 /*----------------------------------------------------------------------------
  *        Main: 
  *---------------------------------------------------------------------------*/
 int main(void) {
+#if AUTOPLAY == 0
   char * sp, * cp, * next;
   U32 i;
+#endif
 
   init_comm(); /* init communication interface*/
 
@@ -835,13 +1649,14 @@ int main(void) {
     lcd_clear();
 
     set_cursor (0, 0);
-    lcd_print("Song Play");
+    lcd_print((unsigned char * ) "Song Play");
     
     
   printf(intro); /* display example info        */
   printf(help);
 
   init_card();
+  aud_init();
 
   T0MCR = 3; /* Interrupt and Reset on MR0  */
   VICVectAddr4 = (unsigned long) T0_IRQHandler; /* Set Interrupt Vector        */
@@ -870,35 +1685,35 @@ int main(void) {
     
     
   while (1) {
-    // printf("\nCmd> "); /* display prompt              */
-    // fflush(stdout);
-    // /* get command line input      */
-    // if (getline(in_line, sizeof(in_line)) == __FALSE) {
-      // continue;
-    // }
-
-    // sp = get_entry( & in_line[0], & next);
-    // if ( * sp == 0) {
-      // continue;
-    // }
-    // for (cp = sp;* cp && * cp != ' '; cp++) {
-      // * cp = toupper( * cp); /* command to upper-case       */
-    // }
-    // for (i = 0; i < CMD_COUNT; i++) {
-      // if (strcmp(sp, (const char * ) & cmd[i].val)) {
-        // continue;
-      // }
-      // init_card(); /* check if card is removed    */
-      // cmd[i].func(next); /* execute command function    */
-      // break;
-    // }
-    // if (i == CMD_COUNT) {
-      // printf("\nCommand error\n");
-    // }
-    
-    printf("Showing Directory");
-    cmd_dir("");
-    cmd_play("A.WAV");
+#if AUTOPLAY == 0
+    printf("\nCmd> "); /* display prompt              */
+    fflush(stdout);
+    /* get command line input      */
+    if (getline(in_line, sizeof(in_line)) == __FALSE) {
+      continue;
+    }
+
+    sp = get_entry( & in_line[0], & next);
+    if ( * sp == 0) {
+      continue;
+    }
+    for (cp = sp;* cp && * cp != ' '; cp++) {
+      * cp = toupper( * cp); /* command to upper-case       */
+    }
+    for (i = 0; i < CMD_COUNT; i++) {
+      if (strcmp(sp, (const char * ) & cmd[i].val)) {
+        continue;
+      }
+      init_card(); /* check if card is removed    */
+      cmd[i].func(next); /* execute command function    */
+      break;
+    }
+    if (i == CMD_COUNT) {
+      printf("\nCommand error\n");
+    }
+#else
+    cmd_playall(NULL); /* plays every *.WAV                 */
+#endif
   }
 }
 
@@ -906,47 +1721,6 @@ int main(void) {
  * end of file
  *---------------------------------------------------------------------------*/
 
-__irq void T0_IRQHandler(void) {
-
-  unsigned int temp = 0;
-
-  switch (curAudio.md) {
-      case 0:
-        /* Mono, 8bit */
-        temp = curAudio.bufrs[curAudio.pos] << 8;
-        curAudio.pos += 1;
-        curAudio.curPos++;
-        break;
-      case 1:
-        /* Stereo, 8bit */
-        temp = (curAudio.bufrs[curAudio.pos] + curAudio.bufrs[curAudio.pos + 1]) << 7;
-        curAudio.pos += 2;
-        curAudio.curPos += 2;
-        break;
-      case 2:
-        /* Mono, 16bit */
-        temp = ((curAudio.bufrs[curAudio.pos + 1] << 8) + (curAudio.bufrs[curAudio.pos])) ^ 0x8000;
-        curAudio.pos += 2;
-        curAudio.curPos += 2;
-        break;
-      default:
-        /* Stereo, 16bit */
-        temp = ((curAudio.bufrs[curAudio.pos + 1] << 8) + (curAudio.bufrs[curAudio.pos])) ^ 0x8000;
-        temp += ((curAudio.bufrs[curAudio.pos + 3] << 8) + (curAudio.bufrs[curAudio.pos + 2])) ^ 0x8000;
-        temp >>= 1;
-        curAudio.pos += 4;
-        curAudio.curPos += 4;
-  }
-  if (curAudio.pos == MEM_LEN)
-    curAudio.swi = 1;
-  temp >>= (7 - curAudio.vol);
-  DACR = temp;
-  temp = 0;
-
-  T0IR = T0IR; /* Clear interrupt flag               */
-  VICVectAddr = 0; /* Acknowledge Interrupt              */
-}
-
 __irq void ADC_IRQHandler(void) {
 
   curAudio.vol = (AD0DR0 >> 6) & 0x3FF; /* Read Conversion Result             */
@@ -958,6 +1732,7 @@ __irq void EINT3_IRQHandler  (void){
 
     int i =0;
     long long int portRe = 0;
+    U32 clk = curAudio.ring.clock;   //press time, for seek latency
 
     //read IO2IntStatF and see what you want to do 
     //use IO2IntClr to clear that interrupt 
@@ -983,11 +1758,11 @@ __irq void EINT3_IRQHandler  (void){
         set_cursor (0, 0);
         //resume/play/start playing    
         if ((curAudio.stat&1)==0){	
-            lcd_print("PLAY");
+            lcd_print((unsigned char * ) "PLAY");
             curAudio.stat |= 01;
             VICIntEnable = (1 << 4);
         }else if ((curAudio.stat&1)==1){
-            lcd_print("PAUSE");
+            lcd_print((unsigned char * ) "PAUSE");
             curAudio.stat &= 0xFE;
             VICIntEnClr = (1 << 4);
         }
@@ -995,29 +1770,31 @@ __irq void EINT3_IRQHandler  (void){
     else if(portRe & STOP){
         //stop
         set_cursor (0, 0);
-        lcd_print("STOP");
+        lcd_print((unsigned char * ) "STOP");
         curAudio.stat |= 2;
         //IO2_INT_CLR = STOP;       
     }
     else if(portRe & FORW){
-        //Next song please
+        //Seek ahead, scans while held
         set_cursor (0, 0);
-        lcd_print("FORW");
-        curAudio.stat |= 4+2;
+        lcd_print((unsigned char * ) "FORW");
+        curAudio.seekAt = clk;
+        curAudio.stat |= 4;
         //IO2_INT_CLR = FORW;       
     }
     else if(portRe & BACK){
-        //previous song please
+        //Seek back, scans while held
         set_cursor (0, 0);
-        lcd_print("BACK");
-        curAudio.stat |= (8+2);
+        lcd_print((unsigned char * ) "BACK");
+        curAudio.seekAt = clk;
+        curAudio.stat |= 8;
         //IO2_INT_CLR = BACK;       
     }else{
         set_cursor (0, 0);
-        lcd_print("Error!");			
+        lcd_print((unsigned char * ) "Error!");			
     }
 
     IO2_INT_CLR = 0xFFFFF;   
     EXTINT = 0x08;  //Clear EINT3 int
     VICVectAddr = 0;                      /* Acknowledge Interrupt              */
-}
\ No newline at end of file
+}
\ No newline at end of file
@@ -26,6 +26,11 @@ typedef struct scmd {
 extern BOOL getline (char *, U32);
 extern void init_serial (void);
 extern int  getkey (void);
+extern void ser_rx_ring (U8 *buf, U32 size);
+extern U8  *ser_rx_get (U32 *len);
+extern void ser_rx_used (U32 len);
+
+extern volatile U32 ser_rx_lost;          /* Received bytes dropped          */
 
 #ifdef RT_AGENT
  #include "RT_Agent.h"
@@ -0,0 +1,453 @@
+/*----------------------------------------------------------------------------
+ *      Name:    SD_RAW.C
+ *      Purpose: Raw sector streaming of card files for playback
+ *----------------------------------------------------------------------------
+ *      raw_open() looks a file up in the FAT once and turns its cluster
+ *      chain into a list of extents, runs of consecutive card sectors.
+ *      The data is then read extent by extent with multi-sector transfers
+ *      on the asynchronous MCI read queue, into two buffers the audio
+ *      engine converts from directly. FlashFS, its cache and the FAT are
+ *      out of the streaming path. Only reading is done here. The chain is
+ *      resolved once at raw_open(), so FlashFS may write other files
+ *      while a stream runs, as COPY does; the card then takes the reads
+ *      and the writes in turn.
+ *---------------------------------------------------------------------------*/
+
+#include <RTL.h>                      /* RTL kernel functions & defines      */
+#include <string.h>                   /* string and memory functions         */
+#include <ctype.h>                    /* character functions                 */
+#include <File_Config.h>
+#include "MCI_LPC23xx.h"
+#include "SD_Raw.h"
+
+#if MCI_IRQ
+/* Run of consecutive card sectors */
+typedef struct raw_ext {
+  U32 sect;
+  U32 cnt;
+} RAW_EXT;
+
+/* Stream buffer half, 'fsec' is the file sector at its start */
+typedef struct raw_half {
+  MCI_RQ rq;
+  U32    fsec;
+} RAW_HALF;
+
+/* Volume layout, from the boot sector */
+static U32 raw_fat;                     /* First FAT sector                  */
+static U32 raw_root;                    /* Root dir sector, cluster on FAT32 */
+static U32 raw_rcnt;                    /* Root dir sectors, 0 on FAT32      */
+static U32 raw_data;                    /* Sector of cluster 2               */
+static U32 raw_spc;                     /* Sectors per cluster               */
+static U32 raw_clus;                    /* Clusters on the volume            */
+static U32 raw_type;                    /* 12, 16 or 32                      */
+
+/* FAT and directory sector in RAW_META_ADDR */
+static MCI_RQ raw_mrq;
+static U32    raw_msec;
+
+/* Open file */
+static RAW_EXT  raw_ext[RAW_EXT_CNT];
+static U32      raw_ext_n;
+static U32      raw_size;               /* File size [bytes]                 */
+static RAW_HALF raw_half[2];
+static U32      raw_cur;                /* Half being consumed               */
+static U32      raw_hsects;             /* Sectors per half                  */
+static U32      raw_pos;                /* File offset of the next byte      */
+static U32      raw_fsec;               /* Next file sector to read          */
+
+/* Local Function Prototypes */
+static U32  rd_u16 (const U8 *p);
+static U32  rd_u32 (const U8 *p);
+static U8  *raw_read (U32 sect);
+static BOOL raw_mount (void);
+static U32  raw_next (U32 clus);
+static BOOL raw_name (const char **pp, U8 *n83);
+static U32  raw_find (U32 dir, const U8 *n83, U32 *size, U32 *attr);
+static void raw_submit (RAW_HALF *h);
+#endif
+
+/*----------------------------------------------------------------------------
+ *        Resolve file 'name' into extents. Returns their number, 0 when
+ *        the file is fragmented beyond RAW_EXT_CNT, not found or has a
+ *        name that is no 8.3 name: stdio has to read it then.
+ *---------------------------------------------------------------------------*/
+U32 raw_open (const char *name) {
+#if MCI_IRQ
+  U8  n83[11];
+  U32 dir, clus, attr, need, sect, i;
+
+  raw_close ();
+  raw_ext_n = 0;
+  raw_msec  = 0xFFFFFFFF;               /* FlashFS may have written meanwhile */
+  if (!raw_mount ()) {
+    return (0);
+  }
+
+  /* Drive prefix "M:" or "M0:", then the path from the root. */
+  if (name[0] && name[1] == ':') {
+    name += 2;
+  }
+  else if (name[0] && name[1] && name[2] == ':') {
+    name += 3;
+  }
+  dir  = (raw_type == 32) ? raw_root : 0;
+  attr = ATTR_DIRECTORY;
+  do {
+    if ((attr & ATTR_DIRECTORY) == 0 || !raw_name (&name, n83)) {
+      return (0);
+    }
+    dir = raw_find (dir, n83, &raw_size, &attr);
+    if (dir == 0) {
+      return (0);
+    }
+  } while (*name);
+  if (attr & ATTR_DIRECTORY) {
+    return (0);
+  }
+
+  /* Walk the chain once, merging clusters that follow each other. */
+  need = (raw_size + raw_spc * 512 - 1) / (raw_spc * 512);
+  for (clus = dir, i = 0; i < need; i++) {
+    if (clus < 2 || clus >= raw_clus + 2) {
+      raw_ext_n = 0;                    /* broken chain                      */
+      return (0);
+    }
+    sect = raw_data + (clus - 2) * raw_spc;
+    if (raw_ext_n && raw_ext[raw_ext_n-1].sect + raw_ext[raw_ext_n-1].cnt == sect) {
+      raw_ext[raw_ext_n-1].cnt += raw_spc;
+    }
+    else if (raw_ext_n == RAW_EXT_CNT) {
+      raw_ext_n = 0;                    /* too fragmented                    */
+      return (0);
+    }
+    else {
+      raw_ext[raw_ext_n].sect = sect;
+      raw_ext[raw_ext_n].cnt  = raw_spc;
+      raw_ext_n++;
+    }
+    if (i + 1 < need) {
+      clus = raw_next (clus);
+    }
+  }
+  raw_buf ((U8 *)RAW_BUF_ADDR, RAW_HALF_SECTS);
+  return (raw_ext_n);
+#else
+  (void)name;
+  return (0);
+#endif
+}
+
+/*----------------------------------------------------------------------------
+ *        Stream into 'buf' instead, two halves of 'sects' sectors each
+ *        (1..MCI_LLI_CNT). Takes effect with the next raw_seek().
+ *---------------------------------------------------------------------------*/
+void raw_buf (U8 *buf, U32 sects) {
+#if MCI_IRQ
+  raw_close ();
+  raw_hsects = sects;
+  raw_half[0].rq.buf = buf;
+  raw_half[1].rq.buf = buf + sects * 512;
+#else
+  (void)buf;
+  (void)sects;
+#endif
+}
+
+/*----------------------------------------------------------------------------
+ *        Stream the open file from byte offset 'pos' on
+ *---------------------------------------------------------------------------*/
+void raw_seek (U32 pos) {
+#if MCI_IRQ
+  raw_close ();
+  raw_pos  = pos;
+  raw_fsec = pos / 512;
+  raw_cur  = 0;
+  raw_submit (&raw_half[0]);
+  raw_submit (&raw_half[1]);
+#else
+  (void)pos;
+#endif
+}
+
+/*----------------------------------------------------------------------------
+ *        Data at the stream position, '*len' bytes up to the end of the
+ *        buffer half. NULL at the end of the file or on a read error.
+ *---------------------------------------------------------------------------*/
+U8 *raw_get (U32 *len) {
+#if MCI_IRQ
+  RAW_HALF *h = &raw_half[raw_cur];
+  U32 off, n;
+
+  if (h->rq.cnt == 0 || raw_pos >= raw_size || !mci_rd_wait (&h->rq)) {
+    return (NULL);
+  }
+  off = raw_pos - h->fsec * 512;
+  n   = h->rq.cnt * 512 - off;
+  if (n > raw_size - raw_pos) {
+    n = raw_size - raw_pos;
+  }
+  *len = n;
+  return (h->rq.buf + off);
+#else
+  (void)len;
+  return (NULL);
+#endif
+}
+
+/*----------------------------------------------------------------------------
+ *        'len' bytes from raw_get() are consumed. A half used up is sent
+ *        for the sectors behind the other one.
+ *---------------------------------------------------------------------------*/
+void raw_used (U32 len) {
+#if MCI_IRQ
+  RAW_HALF *h = &raw_half[raw_cur];
+
+  raw_pos += len;
+  if (raw_pos >= (h->fsec + h->rq.cnt) * 512) {
+    raw_submit (h);
+    raw_cur ^= 1;
+  }
+#else
+  (void)len;
+#endif
+}
+
+/*----------------------------------------------------------------------------
+ *        Wait for the reads still in flight, the buffers are free then
+ *---------------------------------------------------------------------------*/
+void raw_close (void) {
+#if MCI_IRQ
+  U32 i;
+
+  for (i = 0; i < 2; i++) {
+    if (raw_half[i].rq.cnt) {
+      mci_rd_wait (&raw_half[i].rq);
+      raw_half[i].rq.cnt = 0;
+    }
+  }
+#endif
+}
+
+#if MCI_IRQ
+/*----------------------------------------------------------------------------
+ *        Little endian field access
+ *---------------------------------------------------------------------------*/
+static U32 rd_u16 (const U8 *p) {
+  return (p[0] | (p[1] << 8));
+}
+
+static U32 rd_u32 (const U8 *p) {
+  return (p[0] | (p[1] << 8) | (p[2] << 16) | ((U32)p[3] << 24));
+}
+
+/*----------------------------------------------------------------------------
+ *        Card sector 'sect' in RAW_META_ADDR, NULL on a read error
+ *---------------------------------------------------------------------------*/
+static U8 *raw_read (U32 sect) {
+
+  if (sect != raw_msec) {
+    raw_msec       = 0xFFFFFFFF;
+    raw_mrq.sect   = sect;
+    raw_mrq.buf    = (U8 *)RAW_META_ADDR;
+    raw_mrq.cnt    = 1;
+    if (!mci_rd_submit (&raw_mrq) || !mci_rd_wait (&raw_mrq)) {
+      return (NULL);
+    }
+    raw_msec = sect;
+  }
+  return ((U8 *)RAW_META_ADDR);
+}
+
+/*----------------------------------------------------------------------------
+ *        Read the volume layout, from sector 0 or the first partition
+ *---------------------------------------------------------------------------*/
+static BOOL raw_mount (void) {
+  U8 *p;
+  U32 vol, fats, fsz, tot;
+
+  if ((p = raw_read (0)) == NULL) {
+    return (__FALSE);
+  }
+  vol = 0;
+  if (!((p[0] == 0xEB || p[0] == 0xE9) && rd_u16 (&p[11]) == 512)) {
+    /* Master boot record, the volume is the first partition. */
+    if (p[510] != 0x55 || p[511] != 0xAA) {
+      return (__FALSE);
+    }
+    vol = rd_u32 (&p[446 + 8]);
+    if ((p = raw_read (vol)) == NULL || rd_u16 (&p[11]) != 512) {
+      return (__FALSE);
+    }
+  }
+  raw_spc  = p[13];
+  fats     = p[16];
+  raw_rcnt = (rd_u16 (&p[17]) * 32 + 511) / 512;
+  tot      = rd_u16 (&p[19]) ? rd_u16 (&p[19]) : rd_u32 (&p[32]);
+  fsz      = rd_u16 (&p[22]) ? rd_u16 (&p[22]) : rd_u32 (&p[36]);
+  if (raw_spc == 0 || fats == 0 || fsz == 0) {
+    return (__FALSE);
+  }
+  raw_fat  = vol + rd_u16 (&p[14]);
+  raw_data = raw_fat + fats * fsz + raw_rcnt;
+  raw_clus = (tot - (raw_data - vol)) / raw_spc;
+
+  /* The cluster count alone tells the FAT type. */
+  if (raw_clus < 4085) {
+    raw_type = 12;
+  }
+  else if (raw_clus < 65525) {
+    raw_type = 16;
+  }
+  else {
+    raw_type = 32;
+  }
+  raw_root = (raw_type == 32) ? rd_u32 (&p[44]) : raw_fat + fats * fsz;
+  return (__TRUE);
+}
+
+/*----------------------------------------------------------------------------
+ *        Cluster after 'clus' in the chain, 0 at the end or on an error
+ *---------------------------------------------------------------------------*/
+static U32 raw_next (U32 clus) {
+  U8 *p;
+  U32 off, v;
+
+  switch (raw_type) {
+    case 12:
+      /* 12-bit entries may span two sectors, take them byte by byte. */
+      off = clus + clus / 2;
+      if ((p = raw_read (raw_fat + off / 512)) == NULL) {
+        return (0);
+      }
+      v = p[off % 512];
+      off++;
+      if ((p = raw_read (raw_fat + off / 512)) == NULL) {
+        return (0);
+      }
+      v |= p[off % 512] << 8;
+      v  = (clus & 1) ? (v >> 4) : (v & 0xFFF);
+      return ((v >= 0xFF8) ? 0 : v);
+
+    case 16:
+      off = clus * 2;
+      if ((p = raw_read (raw_fat + off / 512)) == NULL) {
+        return (0);
+      }
+      v = rd_u16 (&p[off % 512]);
+      return ((v >= 0xFFF8) ? 0 : v);
+  }
+  off = clus * 4;
+  if ((p = raw_read (raw_fat + off / 512)) == NULL) {
+    return (0);
+  }
+  v = rd_u32 (&p[off % 512]) & 0x0FFFFFFF;
+  return ((v >= 0x0FFFFFF8) ? 0 : v);
+}
+
+/*----------------------------------------------------------------------------
+ *        Next path element of '*pp' as a blank padded 8.3 directory name
+ *---------------------------------------------------------------------------*/
+static BOOL raw_name (const char **pp, U8 *n83) {
+  const char *p = *pp;
+  U32 i, max;
+
+  while (*p == '\\' || *p == '/') {
+    p++;
+  }
+  memset (n83, ' ', 11);
+  for (i = 0, max = 8; *p && *p != '\\' && *p != '/'; p++) {
+    if (*p == '.') {
+      if (max == 3 || i == 0) {
+        return (__FALSE);               /* second dot or no base name        */
+      }
+      i   = 8;
+      max = 3;
+      continue;
+    }
+    if (*p <= ' ' || strchr ("\"*+,:;<=>?[]|", *p) != NULL ||
+        (max == 8 && i == 8) || (max == 3 && i == 11)) {
+      return (__FALSE);                 /* long file name                    */
+    }
+    n83[i++] = (U8)toupper ((U8)*p);
+  }
+  *pp = p;
+  return (n83[0] != ' ');
+}
+
+/*----------------------------------------------------------------------------
+ *        Look 'n83' up in directory 'dir' (a cluster, 0 is the FAT12/16 root)
+ *        and return its first cluster, 0 when not found
+ *---------------------------------------------------------------------------*/
+static U32 raw_find (U32 dir, const U8 *n83, U32 *size, U32 *attr) {
+  U8 *p;
+  U32 sect, cnt, i, e;
+
+  for (;;) {
+    if (dir == 0) {
+      sect = raw_root;
+      cnt  = raw_rcnt;
+    }
+    else {
+      sect = raw_data + (dir - 2) * raw_spc;
+      cnt  = raw_spc;
+    }
+    for (i = 0; i < cnt; i++) {
+      if ((p = raw_read (sect + i)) == NULL) {
+        return (0);
+      }
+      for (e = 0; e < 512; e += 32) {
+        if (p[e] == 0) {
+          return (0);                   /* end of the directory              */
+        }
+        if (p[e] == 0xE5 || (p[e+11] & ATTR_VOLUME_ID)) {
+          continue;                     /* deleted, label or long name part  */
+        }
+        if (memcmp (&p[e], n83, 11) == 0) {
+          *size = rd_u32 (&p[e+28]);
+          *attr = p[e+11];
+          return (rd_u16 (&p[e+26]) | ((raw_type == 32) ? rd_u16 (&p[e+20]) << 16 : 0));
+        }
+      }
+    }
+    if (dir == 0 || (dir = raw_next (dir)) == 0) {
+      return (0);
+    }
+  }
+}
+
+/*----------------------------------------------------------------------------
+ *        Send half 'h' for the next file sectors, up to an extent end
+ *---------------------------------------------------------------------------*/
+static void raw_submit (RAW_HALF *h) {
+  U32 secs, fs, n, i;
+
+  h->rq.cnt = 0;
+  secs = (raw_size + 511) / 512;
+  if (raw_fsec >= secs) {
+    return;
+  }
+  for (fs = raw_fsec, i = 0; fs >= raw_ext[i].cnt; i++) {
+    fs -= raw_ext[i].cnt;
+  }
+  n = raw_ext[i].cnt - fs;
+  if (n > raw_hsects) {
+    n = raw_hsects;
+  }
+  if (n > secs - raw_fsec) {
+    n = secs - raw_fsec;
+  }
+  h->fsec    = raw_fsec;
+  h->rq.sect = raw_ext[i].sect + fs;
+  h->rq.cnt  = n;
+  if (!mci_rd_submit (&h->rq)) {
+    h->rq.cnt = 0;
+    return;
+  }
+  raw_fsec += n;
+}
+#endif
+
+/*----------------------------------------------------------------------------
+ * end of file
+ *---------------------------------------------------------------------------*/
@@ -0,0 +1,30 @@
+/*----------------------------------------------------------------------------
+ *      Name:    SD_RAW.H
+ *      Purpose: Raw sector streaming of card files for playback
+ *---------------------------------------------------------------------------*/
+
+#ifndef __SD_RAW_H
+#define __SD_RAW_H
+
+/* Stream buffers in Ethernet RAM, behind the read-ahead slots. Two halves
+   take turns on the asynchronous read queue, one sector for the FAT.
+   raw_buf() lends larger ones, COPY and SUM stream through the idle audio
+   ring. */
+#define RAW_BUF_ADDR    0x7FE03200      /* Stream buffer base address        */
+#define RAW_HALF_SECTS  3               /* Sectors per half                  */
+#define RAW_META_ADDR   (RAW_BUF_ADDR + 2 * RAW_HALF_SECTS * 512)
+
+#define RAW_EXT_CNT     8               /* Extents, more fall back to stdio  */
+
+extern U32  raw_open (const char *name);
+extern void raw_buf (U8 *buf, U32 sects);
+extern void raw_seek (U32 pos);
+extern U8  *raw_get (U32 *len);
+extern void raw_used (U32 len);
+extern void raw_close (void);
+
+#endif
+
+/*----------------------------------------------------------------------------
+ * end of file
+ *---------------------------------------------------------------------------*/
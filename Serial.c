@@ -10,6 +10,34 @@
 
 #include <LPC23xx.H>                    /* LPC23xx definitions               */
 
+/* Transmit ring, emptied into the 16 byte UART FIFO by the THRE interrupt.
+   A full ring is drained by polling as well, so that output never hangs
+   on the interrupt, even when it is sent with interrupts off.          */
+#define TX_SIZE   256                        /* Power of 2                   */
+#define TX_FIFO   16                         /* UART transmit FIFO depth     */
+
+static unsigned char     tx_buf[TX_SIZE];
+static volatile unsigned tx_head;            /* Written by sendchar          */
+static volatile unsigned tx_tail;            /* Sent up to here              */
+static volatile int      tx_busy;            /* THRE interrupt will follow   */
+
+/* Receive ring, filled by the receive interrupts. CAP lends a larger one
+   with ser_rx_ring() and writes the data to the card straight from it.  */
+#define RX_SIZE   64                         /* Power of 2                   */
+
+static unsigned char     rx_own[RX_SIZE];
+static unsigned char    *rx_buf  = rx_own;
+static unsigned          rx_mask = RX_SIZE - 1;
+static volatile unsigned rx_head;            /* Written by the interrupt     */
+static volatile unsigned rx_tail;            /* Read up to here              */
+
+volatile unsigned ser_rx_lost;               /* Ring full or FIFO overrun    */
+
+static void tx_fill (void);
+static void tx_put (int ch);
+static void rx_take (void);
+static __irq void UART1_IRQHandler (void);
+
 /*----------------------------------------------------------------------------
  *       init_serial:  Initialize Serial Interface
  *---------------------------------------------------------------------------*/
@@ -26,6 +54,94 @@ void init_serial (void) {
   U1DLL = 3;                                 /* for 12MHz PCLK Clock         */
   U1FDR = 0x67;                              /* Fractional Divider           */
   U1LCR = 0x03;                              /* DLAB = 0                     */
+  U1FCR = 0x87;                              /* FIFOs on, RX trigger 8 chars */
+
+  VICVectAddr7 = (unsigned long)UART1_IRQHandler;
+  VICVectCntl7 = 15;                         /* Lowest priority              */
+  U1IER = 0x07;                              /* RX data, THRE, line status   */
+  VICIntEnable = (1 << 7);
+}
+
+/*----------------------------------------------------------------------------
+ *       tx_fill:  Move up to a FIFO of characters from the ring, with the
+ *                 transmitter empty and the THRE interrupt out of the way
+ *---------------------------------------------------------------------------*/
+static void tx_fill (void) {
+  int n;
+
+  for (n = 0; n < TX_FIFO && tx_tail != tx_head; n++) {
+    U1THR = tx_buf[tx_tail % TX_SIZE];
+    tx_tail++;
+  }
+  tx_busy = (n != 0);
+}
+
+/*----------------------------------------------------------------------------
+ *       rx_take:  Move the received characters into the ring
+ *---------------------------------------------------------------------------*/
+static void rx_take (void) {
+  unsigned lsr;
+
+  while ((lsr = U1LSR) & 0x01) {
+    if (lsr & 0x02) {
+      ser_rx_lost++;                         /* FIFO overrun, reading clears */
+    }
+    if (rx_head - rx_tail > rx_mask) {
+      ser_rx_lost++;
+      (void)U1RBR;
+    }
+    else {
+      rx_buf[rx_head & rx_mask] = U1RBR;
+      rx_head++;
+    }
+  }
+}
+
+/*----------------------------------------------------------------------------
+ *       UART1_IRQHandler:  Characters received or transmitter empty
+ *---------------------------------------------------------------------------*/
+static __irq void UART1_IRQHandler (void) {
+  unsigned iir;
+
+  while (((iir = U1IIR) & 0x01) == 0) {      /* reading clears THRE          */
+    switch (iir & 0x0E) {
+      case 0x02:                             /* THRE                         */
+        tx_fill ();
+        break;
+      case 0x06:                             /* line status                  */
+        if (U1LSR & 0x02) {
+          ser_rx_lost++;
+        }
+        /* fall through */
+      case 0x04:                             /* RX data at the trigger level */
+      case 0x0C:                             /* RX character timeout         */
+        rx_take ();
+        break;
+    }
+  }
+  VICVectAddr = 0;                           /* Acknowledge Interrupt        */
+}
+
+/*----------------------------------------------------------------------------
+ *       tx_put:  Queue a character, start the transmitter when it is idle
+ *---------------------------------------------------------------------------*/
+static void tx_put (int ch) {
+  while (tx_head - tx_tail >= TX_SIZE) {
+    U1IER &= ~0x02;
+    if (U1LSR & 0x20) {
+      tx_fill ();
+    }
+    U1IER |= 0x02;
+  }
+  tx_buf[tx_head % TX_SIZE] = (unsigned char)ch;
+  tx_head++;
+  if (!tx_busy) {
+    U1IER &= ~0x02;
+    if (U1LSR & 0x20) {
+      tx_fill ();
+    }
+    U1IER |= 0x02;
+  }
 }
 
 /*----------------------------------------------------------------------------
@@ -33,19 +149,61 @@ void init_serial (void) {
  *---------------------------------------------------------------------------*/
 int sendchar (int ch) {
   if (ch == '\n') {
-    while (!(U1LSR & 0x20));
-    U1THR = '\r';
+    tx_put ('\r');
   }
-  while (!(U1LSR & 0x20));
-  return (U1THR = ch);
+  tx_put (ch);
+  return (ch);
 }
 
 /*----------------------------------------------------------------------------
  *       getkey:  Read a character from Serial Port
  *---------------------------------------------------------------------------*/
 int getkey (void) {
-  while (!(U1LSR & 0x01));
-  return (U1RBR);
+  int ch;
+
+  while (rx_head == rx_tail);
+  ch = rx_buf[rx_tail & rx_mask];
+  rx_tail++;
+  return (ch);
+}
+
+/*----------------------------------------------------------------------------
+ *       ser_rx_ring:  Receive into 'buf' of 'size' bytes, a power of 2,
+ *                     NULL goes back to the own ring. Pending data is lost.
+ *---------------------------------------------------------------------------*/
+void ser_rx_ring (unsigned char *buf, unsigned size) {
+  U1IER &= ~0x05;
+  if (buf == 0) {
+    buf  = rx_own;
+    size = RX_SIZE;
+  }
+  rx_buf  = buf;
+  rx_mask = size - 1;
+  rx_head = 0;
+  rx_tail = 0;
+  U1IER |= 0x05;
+}
+
+/*----------------------------------------------------------------------------
+ *       ser_rx_get:  Received data, '*len' bytes up to the end of the ring
+ *---------------------------------------------------------------------------*/
+unsigned char *ser_rx_get (unsigned *len) {
+  unsigned n, off;
+
+  off = rx_tail & rx_mask;
+  n   = rx_head - rx_tail;
+  if (n > rx_mask + 1 - off) {
+    n = rx_mask + 1 - off;
+  }
+  *len = n;
+  return (&rx_buf[off]);
+}
+
+/*----------------------------------------------------------------------------
+ *       ser_rx_used:  'len' bytes from ser_rx_get() are consumed
+ *---------------------------------------------------------------------------*/
+void ser_rx_used (unsigned len) {
+  rx_tail += len;
 }
 
 /*----------------------------------------------------------------------------
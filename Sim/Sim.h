@@ -0,0 +1,55 @@
+/*----------------------------------------------------------------------------
+ *      Host Simulation
+ *----------------------------------------------------------------------------
+ *      Name:    SIM.H
+ *      Purpose: Host simulation build definitions
+ *---------------------------------------------------------------------------*/
+
+#ifndef __SIM_H
+#define __SIM_H
+
+/* Simulated clocks */
+#define SIM_PCLK        12000000        /* Peripheral clock, timers          */
+#define SIM_TICK_US     1000            /* Host timer period for the VIC     */
+
+/* Push buttons on port 2, active low (see SD_File.c) */
+#define SIM_BTN_PLAY    0x2000
+#define SIM_BTN_STOP    0x1000
+#define SIM_BTN_BACK    0x0800
+#define SIM_BTN_FORW    0x0400
+
+typedef struct sim_cfg {
+  const char *card;                     /* Directory holding the card files  */
+  const char *image;                    /* Disk image behind mci0_drv        */
+  const char *wav;                      /* DAC capture output                */
+  double      speed;                    /* Virtual clock speed factor        */
+  double      limit;                    /* Stop after this many seconds      */
+  U32         adc;                      /* AD0.0 volume level, 0..1023       */
+} SIM_CFG;
+
+extern SIM_CFG sim_cfg;
+
+/* SIM_HAL.C */
+extern void sim_init (void);
+extern void sim_start (void);
+extern void sim_exit (int code);
+extern U64  sim_now (void);
+extern void sim_button (double sec, double hold, U32 mask);
+extern BOOL sim_card_open (const char *image);
+
+/* SIM_FS.C */
+extern FILE *sim_fopen (const char *name, const char *mode);
+
+/* SERIAL.C, getkey() and ser_rx_get() renamed for the simulation build */
+extern int  sendchar (int ch);
+extern int  ser_getkey (void);
+extern U8  *ser_rx_peek (U32 *len);
+
+/* SD_File.c main(), renamed for the simulation build */
+extern int  sd_main (void);
+
+#endif
+
+/*----------------------------------------------------------------------------
+ * end of file
+ *---------------------------------------------------------------------------*/
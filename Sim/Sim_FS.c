@@ -0,0 +1,344 @@
+/*----------------------------------------------------------------------------
+ *      Host Simulation
+ *----------------------------------------------------------------------------
+ *      Name:    SIM_FS.C
+ *      Purpose: RL-FlashFS replacement for the host simulation build
+ *----------------------------------------------------------------------------
+ *      The file API works on a host directory that stands in for the
+ *      card file system. The MCI layer (mci_Init, mci_ReadSector, ...) and
+ *      the mc0_drv sector driver talk to the real MCI_LPC23xx.c driver,
+ *      which in turn reaches the disk image through the simulated MCI.
+ *      Like File_Config.c, mc0_drv goes through the SD_Block.c layer.
+ *---------------------------------------------------------------------------*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <fnmatch.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <RTL.h>
+#include <File_Config.h>
+#include "Sim.h"
+#include "SD_Block.h"
+
+#undef  fopen
+
+#define SIM_MAX_ENT     8192            /* Entries of one directory listing  */
+
+/* Directory listing kept between ffind() calls */
+static char *ent[SIM_MAX_ENT];
+static U32   ent_cnt;
+
+static MCI_DEV mci0_dev;
+
+/*----------------------------------------------------------------------------
+ *        Resolve a card file name case-insensitively, like FAT does
+ *---------------------------------------------------------------------------*/
+static const char *sim_name (const char *name, char *buf, size_t sz) {
+  DIR *d;
+  struct dirent *de;
+
+  if (name[0] && name[1] == ':') {
+    name += 2;                          /* drop a drive prefix "M:"          */
+  }
+  else if (name[0] && name[1] && name[2] == ':') {
+    name += 3;                          /* drop "M0:"                        */
+  }
+  while (*name == '\\') {
+    name++;
+  }
+  snprintf (buf, sz, "%s", name);
+  if (access (buf, F_OK) == 0 || (d = opendir (".")) == NULL) {
+    return (buf);
+  }
+  while ((de = readdir (d)) != NULL) {
+    if (strcasecmp (de->d_name, name) == 0) {
+      snprintf (buf, sz, "%s", de->d_name);
+      break;
+    }
+  }
+  closedir (d);
+  return (buf);
+}
+
+FILE *sim_fopen (const char *name, const char *mode) {
+  char buf[256];
+
+  if (mode[0] != 'r' || mode[1] == '+') {
+    blk_gen++;                          /* FlashFS would write the directory */
+  }
+  return (fopen (sim_name (name, buf, sizeof (buf)), mode));
+}
+
+/*----------------------------------------------------------------------------
+ *        File System API
+ *---------------------------------------------------------------------------*/
+int finit (const char *drive) {
+  (void)drive;
+  /* FlashFS initializes the card on every call, so does the sim. */
+  if (sim_cfg.image != NULL && !mc0_drv.Init (0)) {
+    fprintf (stderr, "[sim] card init failed\n");
+  }
+  return (access (".", R_OK | W_OK) == 0 ? 0 : 1);
+}
+
+int funinit (const char *drive) {
+  (void)drive;
+  return (0);
+}
+
+int fdelete (const char *filename) {
+  char buf[256];
+  size_t n;
+
+  blk_gen++;
+  sim_name (filename, buf, sizeof (buf));
+  n = strlen (buf);
+  if (n && buf[n - 1] == '\\') {
+    buf[n - 1] = 0;
+    return (rmdir (buf) == 0 ? 0 : 1);
+  }
+  return (unlink (buf) == 0 ? 0 : 1);
+}
+
+int frename (const char *oldname, const char *newname) {
+  char buf[256];
+
+  blk_gen++;
+  return (rename (sim_name (oldname, buf, sizeof (buf)), newname) == 0 ? 0 : 1);
+}
+
+static int ent_cmp (const void *a, const void *b) {
+  return (strcmp (*(char * const *)a, *(char * const *)b));
+}
+
+int ffind (const char *pattern, FINFO *info) {
+  DIR *d;
+  struct dirent *de;
+  struct stat st;
+  struct tm tm;
+  const char *pat = pattern;
+  U32 i;
+
+  if (info->fileID == 0) {
+    /* New search, take a sorted snapshot of the directory. */
+    for (i = 0; i < ent_cnt; i++) {
+      free (ent[i]);
+    }
+    ent_cnt = 0;
+    if (strcmp (pat, "*.*") == 0 || pat[0] == 0) {
+      pat = "*";
+    }
+    if ((d = opendir (".")) == NULL) {
+      return (1);
+    }
+    while ((de = readdir (d)) != NULL && ent_cnt < SIM_MAX_ENT) {
+      if (de->d_name[0] == '.') {
+        continue;
+      }
+      if (fnmatch (pat, de->d_name, FNM_CASEFOLD) == 0) {
+        ent[ent_cnt++] = strdup (de->d_name);
+      }
+    }
+    closedir (d);
+    qsort (ent, ent_cnt, sizeof (ent[0]), ent_cmp);
+  }
+  if (info->fileID >= ent_cnt || stat (ent[info->fileID], &st) != 0) {
+    return (1);
+  }
+  snprintf ((char *)info->name, sizeof (info->name), "%s", ent[info->fileID]);
+  info->size   = (U32)st.st_size;
+  info->attrib = S_ISDIR (st.st_mode) ? ATTR_DIRECTORY : ATTR_ARCHIVE;
+  localtime_r (&st.st_mtime, &tm);
+  info->time.hr   = tm.tm_hour;
+  info->time.min  = tm.tm_min;
+  info->time.sec  = tm.tm_sec;
+  info->time.day  = tm.tm_mday;
+  info->time.mon  = tm.tm_mon + 1;
+  info->time.year = tm.tm_year + 1900;
+  info->fileID++;
+  return (0);
+}
+
+U64 ffree (const char *drive) {
+  struct statvfs vfs;
+
+  (void)drive;
+  if (statvfs (".", &vfs) != 0) {
+    return (0);
+  }
+  return ((U64)vfs.f_bavail * vfs.f_frsize);
+}
+
+int fformat (const char *drive) {
+  (void)drive;
+  fprintf (stderr, "[sim] FORMAT is not emulated on a host directory\n");
+  return (1);
+}
+
+/*----------------------------------------------------------------------------
+ *        MCI layer: SD card protocol on top of an MCI_DRV driver
+ *---------------------------------------------------------------------------*/
+static BOOL mci_cmd (MCI_DEV *mci, U8 cmd, U32 arg, U32 resp, U32 *rp) {
+  U32 r[4];
+
+  return (mci->drv->Command (cmd, arg, resp, rp ? rp : r));
+}
+
+static BOOL mci_acmd (MCI_DEV *mci, U8 cmd, U32 arg, U32 resp, U32 *rp) {
+  if (!mci_cmd (mci, APP_CMD, mci->rca << 16, RESP_SHORT, NULL)) {
+    return (__FALSE);
+  }
+  return (mci_cmd (mci, cmd, arg, resp, rp));
+}
+
+static BOOL mci_wait_tran (MCI_DEV *mci) {
+  U32 r[4], i;
+
+  for (i = 0; i < 100000; i++) {
+    if (mci_cmd (mci, SEND_STATUS, mci->rca << 16, RESP_SHORT, r) &&
+        ((r[0] >> 9) & 0xF) == 4 && (r[0] & 0x100)) {
+      return (__TRUE);
+    }
+  }
+  return (__FALSE);
+}
+
+BOOL mci_Init (U32 mode, MCI_DEV *mci) {
+  U32 r[4], i;
+
+  (void)mode;
+  mci->drv = &mci0_drv;
+  if (!mci->drv->Init ()) {
+    return (__FALSE);
+  }
+  mci->drv->BusMode (BUS_OPEN_DRAIN);
+  mci->drv->BusWidth (1);
+  mci->drv->BusSpeed (400);
+  mci->rca = 0;
+
+  mci_cmd (mci, GO_IDLE_STATE, 0, RESP_NONE, NULL);
+  mci->sdhc = mci_cmd (mci, SEND_IF_COND, 0x1AA, RESP_SHORT, r) &&
+              (r[0] & 0xFFF) == 0x1AA;
+  for (i = 0; i < 1000; i++) {
+    if (mci_acmd (mci, SEND_APP_OP_COND, 0x40FF8000, RESP_SHORT, r) &&
+        (r[0] & 0x80000000)) {
+      break;
+    }
+  }
+  if (i == 1000) {
+    return (__FALSE);
+  }
+  mci->sdhc = (r[0] & 0x40000000) != 0;
+  if (!mci_cmd (mci, ALL_SEND_CID, 0, RESP_LONG, r) ||
+      !mci_cmd (mci, SET_RELATIVE_ADDR, 0, RESP_SHORT, r)) {
+    return (__FALSE);
+  }
+  mci->rca = r[0] >> 16;
+  mci->drv->BusMode (BUS_PUSH_PULL);
+
+  if (!mci_cmd (mci, SEND_CSD, mci->rca << 16, RESP_LONG, r)) {
+    return (__FALSE);
+  }
+  /* CSD 2.0: C_SIZE in bits 69:48 */
+  mci->block_cnt = ((((r[1] & 0x3F) << 16) | (r[2] >> 16)) + 1) * 1024;
+
+  if (!mci_cmd (mci, SELECT_CARD, mci->rca << 16, RESP_SHORT, r)) {
+    return (__FALSE);
+  }
+  mci->drv->BusSpeed (25000);
+  if (mci_acmd (mci, SET_ACMD_BUS_WIDTH, 2, RESP_SHORT, r)) {
+    mci->drv->BusWidth (4);
+  }
+  mci_cmd (mci, SET_BLOCK_LEN, 512, RESP_SHORT, r);
+  return (__TRUE);
+}
+
+BOOL mci_UnInit (U32 mode, MCI_DEV *mci) {
+  (void)mode;
+  return (mci->drv->UnInit ());
+}
+
+BOOL mci_ReadSector (U32 sect, U8 *buf, U32 cnt, MCI_DEV *mci) {
+  U32 addr = mci->sdhc ? sect : sect * 512;
+  BOOL ok;
+
+  if (!mci_cmd (mci, (cnt > 1) ? READ_MULT_BLOCK : READ_BLOCK, addr, RESP_SHORT, NULL)) {
+    return (__FALSE);
+  }
+  ok = mci->drv->ReadBlock (sect, buf, cnt);
+  if (cnt > 1) {
+    mci_cmd (mci, STOP_TRANS, 0, RESP_SHORT, NULL);
+  }
+  return (ok && mci_wait_tran (mci));
+}
+
+BOOL mci_WriteSector (U32 sect, U8 *buf, U32 cnt, MCI_DEV *mci) {
+  U32 addr = mci->sdhc ? sect : sect * 512;
+  BOOL ok;
+
+  if (!mci_cmd (mci, (cnt > 1) ? WRITE_MULT_BLOCK : WRITE_BLOCK, addr, RESP_SHORT, NULL)) {
+    return (__FALSE);
+  }
+  ok = mci->drv->WriteBlock (sect, buf, cnt);
+  if (cnt > 1) {
+    mci_cmd (mci, STOP_TRANS, 0, RESP_SHORT, NULL);
+  }
+  return (ok && mci_wait_tran (mci));
+}
+
+BOOL mci_ReadInfo (Media_INFO *info, MCI_DEV *mci) {
+  info->block_cnt  = mci->block_cnt;
+  info->read_blen  = 512;
+  info->write_blen = 512;
+  return (__TRUE);
+}
+
+/*----------------------------------------------------------------------------
+ *        Memory Card Drive 0 sector driver, as File_lib.c defines it
+ *---------------------------------------------------------------------------*/
+static BOOL mc0_Init (U32 mode) {
+  return (blk_Init (mode, &mci0_dev));
+}
+
+static BOOL mc0_UnInit (U32 mode) {
+  return (mci_UnInit (mode, &mci0_dev));
+}
+
+static BOOL mc0_RdSect (U32 sect, U8 *buf, U32 cnt) {
+  return (blk_ReadSector (sect, buf, cnt, &mci0_dev));
+}
+
+static BOOL mc0_WrSect (U32 sect, U8 *buf, U32 cnt) {
+  return (blk_WriteSector (sect, buf, cnt, &mci0_dev));
+}
+
+static BOOL mc0_RdInfo (Media_INFO *info) {
+  return (mci_ReadInfo (info, &mci0_dev));
+}
+
+static U32 mc0_DevCtrl (U32 code, void *p) {
+  (void)code;
+  (void)p;
+  return (mci0_drv.CheckMedia ? mci0_drv.CheckMedia () : M_INSERTED);
+}
+
+FAT_DRV mc0_drv = {
+  mc0_Init,
+  mc0_UnInit,
+  mc0_RdSect,
+  mc0_WrSect,
+  mc0_RdInfo,
+  mc0_DevCtrl
+};
+
+/*----------------------------------------------------------------------------
+ * end of file
+ *---------------------------------------------------------------------------*/
@@ -0,0 +1,1100 @@
+/*----------------------------------------------------------------------------
+ *      Host Simulation
+ *----------------------------------------------------------------------------
+ *      Name:    SIM_HAL.C
+ *      Purpose: LPC23xx peripheral models driven by a virtual clock
+ *----------------------------------------------------------------------------
+ *      Registers are plain memory cells. sim_reg() commits the side effects
+ *      of the previous write (write-one-to-clear registers, MCI commands,
+ *      DMA transfers, A/D start) before it serves the next access.
+ *      A periodic host signal plays the role of the interrupt line: it
+ *      advances the virtual clock, fires Timer0 as IRQ or FIQ, dispatches
+ *      pending VIC channels by priority and samples DACR into a WAV file.
+ *      UART1 sends and receives at its programmed baud rate, stdin feeds
+ *      the receiver and the transmitter writes to stdout; the firmware's
+ *      own stdout is routed through sendchar() in SERIAL.C.
+ *---------------------------------------------------------------------------*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <RTL.h>
+#include <File_Config.h>
+#include <LPC23xx.H>
+#include "Sim.h"
+
+/* MCI status bits, as in MCI_LPC23xx.h */
+#define MCI_CMD_CRC_FAIL    0x00000001
+#define MCI_CMD_TIMEOUT     0x00000004
+#define MCI_DATA_TIMEOUT    0x00000008
+#define MCI_CMD_RESP_END    0x00000040
+#define MCI_CMD_SENT        0x00000080
+#define MCI_DATA_END        0x00000100
+#define MCI_DATA_BLK_END    0x00000400
+#define MCI_RX_DATA_AVAIL   0x00200000
+
+/* SD commands the card model answers beyond those in File_Config.h */
+#define SWITCH_FUNC         6
+#define SD_STATUS           13          /* ACMD                              */
+#define SET_WR_BLK_ERASE_COUNT 23       /* ACMD                              */
+#define SEND_SCR            51          /* ACMD                              */
+
+/* AHB RAM blocks used for DMA buffers, mapped at their LPC23xx addresses */
+#define SIM_AHB_BASE        0x7FD00000
+#define SIM_AHB_SIZE        0x00200000
+
+/* VIC channels */
+#define VIC_TIMER0          4
+#define VIC_UART1           7
+#define VIC_EINT3           17
+#define VIC_ADC0            18
+#define VIC_MCI             24
+#define VIC_GPDMA           25
+
+/* Card states (R1 CURRENT_STATE) */
+#define CARD_IDLE           0
+#define CARD_READY          1
+#define CARD_IDENT          2
+#define CARD_STBY           3
+#define CARD_TRAN           4
+#define CARD_DATA           5
+#define CARD_RCV            6
+
+#define SIM_MAX_BTN         32
+
+SIM_CFG sim_cfg = { ".", NULL, NULL, 1.0, 0, 512 };
+
+/* Register file, in .bss so that register addresses fit into 32 bits */
+static volatile unsigned int reg[SIM_REG_CNT];
+#define R(r)    reg[SIM_##r]
+
+/* Peripheral state behind the registers */
+static U32 vic_enable;
+static U32 vic_soft;
+static U32 adc_raw;
+static U32 t_run[2];
+static U64 t_start[2];
+static U64 t0_next;
+
+/* Interrupt context and lock between foreground and the tick handler */
+static volatile sig_atomic_t lock;
+static volatile sig_atomic_t in_isr;
+static volatile sig_atomic_t stop;
+
+static struct timespec host_t0;
+static U64 ticks_done;
+static U32 tick_skip;
+static U64 t0_events;
+
+/* Scheduled button presses */
+static struct { U64 at; U64 hold; U32 mask; U32 state; } btn[SIM_MAX_BTN];
+static U32 btn_cnt;
+
+/* DAC capture */
+static int  wav_fd = -1;
+static U32  wav_rate;
+static U64  wav_samples;
+static S16  wav_buf[2048];
+static U32  wav_cnt;
+
+/* UART1 model. U1THR holds UART_NO_WRITE until the firmware writes it. */
+#define UART_FIFO           16
+#define UART_NO_WRITE       0x100
+
+static struct {
+  U8   tx[UART_FIFO];                   /* Transmit FIFO                     */
+  U32  tx_out, tx_cnt;
+  U64  tx_next;                         /* Next character leaves the FIFO    */
+  BOOL thre;                            /* THRE interrupt pending            */
+  BOOL cr;                              /* CR held back, LF may follow       */
+  U8   rx[UART_FIFO];                   /* Receive FIFO                      */
+  U32  rx_out, rx_cnt;
+  U64  rx_next;                         /* Next character comes off the line */
+  U64  rx_last;                         /* Last character received           */
+  BOOL oe;                              /* Overrun, cleared by reading LSR   */
+  BOOL eof;                             /* stdin is exhausted                */
+  U8   in[256];                         /* Characters read from stdin        */
+  U32  in_pos, in_len;
+} uart;
+
+/* SD card model */
+static struct {
+  int fd;
+  U64 size;
+  U32 state;
+  U32 rca;
+  BOOL app;
+  U32 addr;
+  BOOL multi;
+  BOOL wide;
+  BOOL hs;                              /* High speed function selected      */
+  U8   reg[64];                         /* Short data block (SCR, status)    */
+  U32  reg_len;
+  U32  reg_pos;
+} card = { -1 };
+
+extern __irq void FIQ_Handler (void);
+
+static void sim_commit (void);
+static void sim_irq (void);
+static void uart_update (U64 now);
+static U32  uart_iir (U64 now);
+static BOOL uart_idle (void);
+static void sim_console (void);
+
+/*----------------------------------------------------------------------------
+ *        Virtual clock in PCLK ticks
+ *---------------------------------------------------------------------------*/
+U64 sim_now (void) {
+  struct timespec ts;
+  double ns;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  ns = (double)(ts.tv_sec - host_t0.tv_sec) * 1e9 +
+       (double)(ts.tv_nsec - host_t0.tv_nsec);
+  return ((U64)(ns * sim_cfg.speed * (SIM_PCLK / 1e9)));
+}
+
+/*----------------------------------------------------------------------------
+ *        Register access
+ *---------------------------------------------------------------------------*/
+volatile unsigned int *sim_reg (int id) {
+  U32 n;
+
+  if (in_isr) {
+    sim_commit ();
+  }
+  else {
+    lock = 1;
+    sim_commit ();
+    /* A request raised by the access (MCI, DMA completion) is taken at
+       once, as the core would, not at the next host tick.               */
+    in_isr = 1;
+    sim_irq ();
+    in_isr = 0;
+    lock = 0;
+    if (stop && uart_idle ()) {
+      sim_exit (0);
+    }
+  }
+
+  /* A MCI_FIFO read takes the next word of a short data block. */
+  if (id == SIM_MCI_FIFO && (R(MCI_STATUS) & MCI_RX_DATA_AVAIL)) {
+    memcpy ((void *)&reg[id], &card.reg[card.reg_pos], 4);
+    card.reg_pos += 4;
+    if (card.reg_pos >= card.reg_len) {
+      card.reg_len     = 0;
+      card.state       = CARD_TRAN;
+      R(MCI_STATUS)    = (R(MCI_STATUS) & ~MCI_RX_DATA_AVAIL) |
+                         MCI_DATA_END | MCI_DATA_BLK_END;
+      R(MCI_DATA_CTRL) &= ~0x01;
+    }
+  }
+
+  /* UART1: reading RBR takes a character off the receive FIFO, reading
+     IIR acknowledges THRE, reading LSR clears the overrun flag.         */
+  if (id == SIM_U1RBR && uart.rx_cnt) {
+    reg[id] = uart.rx[uart.rx_out];
+    uart.rx_out = (uart.rx_out + 1) % UART_FIFO;
+    uart.rx_cnt--;
+  }
+  if (id == SIM_U1IIR) {
+    reg[id] = 0xC0 | uart_iir (sim_now ());
+    if ((reg[id] & 0x0F) == 0x02) {
+      uart.thre = 0;
+    }
+  }
+  if (id == SIM_U1LSR) {
+    reg[id] = (uart.rx_cnt ? 0x01 : 0) | (uart.oe ? 0x02 : 0) |
+              (uart.tx_cnt ? 0 : 0x60);
+    uart.oe = 0;
+  }
+
+  /* Timer counters are derived from the virtual clock on read. */
+  if (id == SIM_T0TC || id == SIM_T1TC) {
+    n = (id == SIM_T1TC);
+    if (t_run[n]) {
+      U64 tc = (sim_now () - t_start[n]) / (reg[n ? SIM_T1PR : SIM_T0PR] + 1);
+      if (reg[n ? SIM_T1MCR : SIM_T0MCR] & 2) {
+        tc %= (U64)reg[n ? SIM_T1MR0 : SIM_T0MR0] + 1;
+      }
+      reg[id] = (U32)tc;
+    }
+  }
+  return (&reg[id]);
+}
+
+/*----------------------------------------------------------------------------
+ *        SD card model: command phase
+ *---------------------------------------------------------------------------*/
+static U32 card_r1 (void) {
+  return ((card.state << 9) | 0x100 | (card.app ? 0x20 : 0));
+}
+
+static void card_command (U32 cmd, U32 arg, U32 resp) {
+  U32 r[4] = { 0, 0, 0, 0 };
+  U32 rcmd = cmd;
+  U32 stat = MCI_CMD_RESP_END;
+  U32 csize;
+  BOOL app = card.app;
+
+  card.app = __FALSE;
+  if (card.fd < 0 && cmd != GO_IDLE_STATE) {
+    R(MCI_STATUS) |= MCI_CMD_TIMEOUT;
+    return;
+  }
+
+  switch (cmd | (app ? 0x100 : 0)) {
+    case GO_IDLE_STATE:
+      card.state = CARD_IDLE;
+      card.wide  = __FALSE;
+      card.hs    = __FALSE;
+      R(MCI_STATUS) |= MCI_CMD_SENT;
+      return;
+
+    case SEND_IF_COND:
+      r[0] = arg & 0xFFF;
+      break;
+
+    case APP_CMD:
+    case APP_CMD | 0x100:
+      card.app = __TRUE;
+      r[0] = card_r1 ();
+      break;
+
+    case SEND_APP_OP_COND | 0x100:
+      /* R3 carries no CRC, the MCI flags a CRC failure. */
+      card.state = CARD_READY;
+      r[0] = 0xC0FF8000;                /* powered up, high capacity         */
+      rcmd = 0x3F;
+      stat = MCI_CMD_CRC_FAIL;
+      break;
+
+    case ALL_SEND_CID:
+      card.state = CARD_IDENT;
+      r[0] = 0x03534453;                /* 'SDS' manufacturer, "SIM" product */
+      r[1] = 0x494D2020;
+      r[2] = 0x10000001;
+      r[3] = 0x00A10001;
+      rcmd = 0x3F;
+      break;
+
+    case SET_RELATIVE_ADDR:
+      card.state = CARD_STBY;
+      card.rca   = 0x1234;
+      r[0] = (card.rca << 16) | (card.state << 9) | 0x100;
+      break;
+
+    case SEND_CSD:
+      /* CSD version 2.0, C_SIZE = blocks / 1024 - 1 */
+      csize = (U32)(card.size / (512 * 1024)) - 1;
+      r[0] = 0x400E0032;
+      r[1] = 0x5B590000 | ((csize >> 16) & 0x3F);
+      r[2] = (csize << 16) | 0x7F80;
+      r[3] = 0x0A400001;
+      rcmd = 0x3F;
+      break;
+
+    case SELECT_CARD:
+      card.state = (arg >> 16) == card.rca ? CARD_TRAN : CARD_STBY;
+      r[0] = card_r1 ();
+      break;
+
+    case SET_ACMD_BUS_WIDTH | 0x100:
+      card.wide = (arg & 3) == 2;
+      r[0] = card_r1 ();
+      break;
+
+    case SET_BLOCK_LEN:
+    case SEND_STATUS:
+      if (card.state == CARD_DATA || card.state == CARD_RCV) {
+        if (!card.multi) {
+          card.state = CARD_TRAN;
+        }
+      }
+      r[0] = card_r1 ();
+      break;
+
+    case READ_BLOCK:
+    case READ_MULT_BLOCK:
+    case WRITE_BLOCK:
+    case WRITE_MULT_BLOCK:
+      r[0]       = card_r1 ();
+      card.addr  = arg;                 /* block addressed (SDHC)            */
+      card.multi = (cmd == READ_MULT_BLOCK || cmd == WRITE_MULT_BLOCK);
+      card.state = (cmd < WRITE_BLOCK) ? CARD_DATA : CARD_RCV;
+      break;
+
+    case SET_WR_BLK_ERASE_COUNT | 0x100:
+      /* Pre-erase count: the image needs no erase, only the answer. */
+      r[0] = card_r1 ();
+      break;
+
+    case SEND_SCR | 0x100:
+      /* SD 2.00, 1 and 4 bit bus */
+      memset (card.reg, 0, sizeof (card.reg));
+      card.reg[0]  = 0x02;
+      card.reg[1]  = 0x05;
+      card.reg_len = 8;
+      card.reg_pos = 0;
+      r[0] = card_r1 ();
+      card.state = CARD_DATA;
+      break;
+
+    case SD_STATUS | 0x100:
+      memset (card.reg, 0, sizeof (card.reg));
+      card.reg[0]  = card.wide ? 0x80 : 0x00;
+      card.reg_len = 64;
+      card.reg_pos = 0;
+      r[0] = card_r1 ();
+      card.state = CARD_DATA;
+      break;
+
+    case SWITCH_FUNC:
+      /* Group 1 offers function 1 (high speed), mode 1 selects it. */
+      memset (card.reg, 0, sizeof (card.reg));
+      card.reg[1]  = 100;               /* 100 mA                            */
+      card.reg[13] = 0x03;
+      if ((arg & 0xF) == 1) {
+        card.reg[16] = 0x01;
+        if (arg & 0x80000000) {
+          card.hs = __TRUE;
+        }
+      }
+      card.reg_len = 64;
+      card.reg_pos = 0;
+      r[0] = card_r1 ();
+      card.state = CARD_DATA;
+      break;
+
+    case STOP_TRANS:
+      card.state = CARD_TRAN;
+      card.multi = __FALSE;
+      r[0] = card_r1 ();
+      break;
+
+    default:
+      R(MCI_STATUS) |= MCI_CMD_TIMEOUT;
+      return;
+  }
+  if (resp == RESP_NONE) {
+    R(MCI_STATUS) |= MCI_CMD_SENT;
+    return;
+  }
+  R(MCI_RESP_CMD) = rcmd;
+  R(MCI_RESP0)    = r[0];
+  R(MCI_RESP1)    = r[1];
+  R(MCI_RESP2)    = r[2];
+  R(MCI_RESP3)    = r[3];
+  R(MCI_STATUS)  |= stat;
+}
+
+/*----------------------------------------------------------------------------
+ *        SD card model: data phase through GPDMA channel 0. The channel
+ *        follows its linked list, each item moves (CTRL & 0xFFF) words.
+ *---------------------------------------------------------------------------*/
+static void card_data (void) {
+  U32 len = R(MCI_DATA_LEN);
+  U32 src = R(GPDMA_CH0_SRC);
+  U32 dst = R(GPDMA_CH0_DEST);
+  U32 lli = R(GPDMA_CH0_LLI);
+  U32 ctrl = R(GPDMA_CH0_CTRL);
+  U32 done, n, *item;
+  BOOL rd = (R(MCI_DATA_CTRL) & 0x02) != 0;
+  U8 *mem;
+  U64 off;
+  ssize_t got;
+
+  for (done = 0; done < len; ) {
+    n = (ctrl & 0xFFF) * 4;
+    if (n > len - done) {
+      n = len - done;
+    }
+    off = (U64)card.addr * 512 + done;
+    if (rd) {
+      /* Card to controller, MCI FIFO to memory. */
+      mem = (U8 *)(uintptr_t)dst;
+      got = (off < card.size) ? pread (card.fd, mem, n, off) : 0;
+      if (got < 0) {
+        got = 0;
+      }
+      memset (mem + got, 0, n - got);
+    }
+    else {
+      /* Memory to MCI FIFO, card programs the blocks. */
+      mem = (U8 *)(uintptr_t)src;
+      if (off + n <= card.size) {
+        if (pwrite (card.fd, mem, n, off) != (ssize_t)n) {
+          fprintf (stderr, "[sim] card write failed at block %u\n", card.addr);
+        }
+      }
+    }
+    done += n;
+    if (lli == 0) {
+      break;
+    }
+    item = (U32 *)(uintptr_t)lli;
+    src  = item[0];
+    dst  = item[1];
+    lli  = item[2];
+    ctrl = item[3];
+  }
+  card.addr += done / 512;
+  if (!card.multi) {
+    card.state = CARD_TRAN;
+  }
+
+  R(MCI_DATA_CNT)          = len - done;
+  R(MCI_DATA_CTRL)        &= ~0x01;
+  R(MCI_STATUS)           |= (done < len) ? MCI_DATA_TIMEOUT :
+                                            MCI_DATA_END | MCI_DATA_BLK_END;
+  R(GPDMA_CH0_CFG)        &= ~0x01;
+  R(GPDMA_RAW_INT_TCSTAT) |= 0x01;
+  if (R(GPDMA_CH0_CFG) & (1 << 15)) {
+    R(GPDMA_INT_TCSTAT)   |= 0x01;
+  }
+}
+
+/*----------------------------------------------------------------------------
+ *        Commit side effects of register writes
+ *---------------------------------------------------------------------------*/
+static void sim_commit (void) {
+  U32 v, n;
+
+  /* VIC: enable and soft interrupt registers are set-only. */
+  vic_enable |= R(VICIntEnable);
+  if ((v = R(VICIntEnClr)) != 0) {
+    vic_enable &= ~v;
+    R(VICIntEnClr) = 0;
+  }
+  R(VICIntEnable) = vic_enable;
+  vic_soft |= R(VICSoftInt);
+  if ((v = R(VICSoftIntClear)) != 0) {
+    vic_soft &= ~v;
+    R(VICSoftIntClear) = 0;
+  }
+  R(VICSoftInt) = vic_soft;
+
+  /* Timers: interrupt flags are write-one-to-clear, track run state. */
+  R(T0IR) = 0;
+  R(T1IR) = 0;
+  for (n = 0; n < 2; n++) {
+    v = reg[n ? SIM_T1TCR : SIM_T0TCR];
+    if ((v & 1) && !(v & 2) && !t_run[n]) {
+      t_run[n]   = 1;
+      t_start[n] = sim_now ();
+      if (n == 0) {
+        t0_next = t_start[0] + R(T0MR0) + 1;
+      }
+    }
+    else if (!(v & 1) || (v & 2)) {
+      t_run[n] = 0;
+      reg[n ? SIM_T1TC : SIM_T0TC] = 0;
+    }
+  }
+
+  /* A/D converter: a started conversion completes at once. */
+  if (((R(AD0CR) >> 24) & 7) == 1) {
+    R(AD0CR)  &= ~0x07000000;
+    R(AD0DR0)  = 0x80000000 | ((sim_cfg.adc & 0x3FF) << 6);
+    if (R(AD0INTEN) & 1) {
+      adc_raw = 1;
+    }
+  }
+
+  /* GPIO interrupt flags */
+  if ((v = R(IO2_INT_CLR)) != 0) {
+    R(IO2_INT_STAT_F) &= ~v;
+    R(IO2_INT_STAT_R) &= ~v;
+    R(IO2_INT_CLR)     = 0;
+  }
+  R(EXTINT) = 0;
+
+  /* GPDMA */
+  if ((v = R(GPDMA_INT_TCCLR)) != 0) {
+    R(GPDMA_RAW_INT_TCSTAT) &= ~v;
+    R(GPDMA_INT_TCSTAT)     &= ~v;
+    R(GPDMA_INT_TCCLR)       = 0;
+  }
+  if ((v = R(GPDMA_INT_ERR_CLR)) != 0) {
+    R(GPDMA_RAW_INT_ERR_STAT) &= ~v;
+    R(GPDMA_INT_ERR_STAT)     &= ~v;
+    R(GPDMA_INT_ERR_CLR)       = 0;
+  }
+
+  /* UART1: a write to THR queues a character, dropped when the FIFO is
+     full as on the chip.                                              */
+  if ((v = R(U1THR)) != UART_NO_WRITE) {
+    if (uart.tx_cnt < UART_FIFO) {
+      if (uart.tx_cnt == 0) {
+        uart.tx_next = sim_now ();
+      }
+      uart.tx[(uart.tx_out + uart.tx_cnt) % UART_FIFO] = (U8)v;
+      uart.tx_cnt++;
+    }
+    uart.thre = 0;
+    R(U1THR)  = UART_NO_WRITE;
+  }
+  uart_update (sim_now ());
+
+  /* MCI */
+  if ((v = R(MCI_CLEAR)) != 0) {
+    R(MCI_STATUS) &= ~v;
+    R(MCI_CLEAR)   = 0;
+  }
+  if ((v = R(MCI_COMMAND)) & 0x400) {
+    R(MCI_COMMAND) = v & ~0x400;
+    card_command (v & 0x3F, R(MCI_ARGUMENT),
+                  (v & 0x40) ? ((v & 0x80) ? RESP_LONG : RESP_SHORT) : RESP_NONE);
+  }
+  if ((R(MCI_DATA_CTRL) & 0x0B) == 0x03 && card.reg_len) {
+    /* Short block read by the CPU, see sim_reg() for MCI_FIFO. */
+    R(MCI_STATUS) |= MCI_RX_DATA_AVAIL;
+  }
+  if ((R(MCI_DATA_CTRL) & 0x01) && (R(GPDMA_CONFIG) & 0x01) &&
+      (R(GPDMA_CH0_CFG) & 0x01)) {
+    if (card.state == CARD_DATA || card.state == CARD_RCV) {
+      card_data ();
+    }
+  }
+  R(GPDMA_INT_STAT) = R(GPDMA_INT_TCSTAT) | R(GPDMA_INT_ERR_STAT);
+}
+
+/*----------------------------------------------------------------------------
+ *        DAC capture into a mono 16-bit WAV file
+ *---------------------------------------------------------------------------*/
+static void wav_header (U32 rate, U64 samples) {
+  U8 h[44];
+  U32 data = (U32)(samples * 2);
+
+  memcpy (&h[0], "RIFF", 4);
+  h[4]  = (U8)(data + 36);       h[5]  = (U8)((data + 36) >> 8);
+  h[6]  = (U8)((data + 36) >> 16); h[7] = (U8)((data + 36) >> 24);
+  memcpy (&h[8], "WAVEfmt ", 8);
+  h[16] = 16; h[17] = 0; h[18] = 0; h[19] = 0;
+  h[20] = 1;  h[21] = 0;          /* PCM                                */
+  h[22] = 1;  h[23] = 0;          /* mono                               */
+  h[24] = (U8)rate;        h[25] = (U8)(rate >> 8);
+  h[26] = (U8)(rate >> 16); h[27] = (U8)(rate >> 24);
+  h[28] = (U8)(rate * 2);  h[29] = (U8)((rate * 2) >> 8);
+  h[30] = (U8)((rate * 2) >> 16); h[31] = (U8)((rate * 2) >> 24);
+  h[32] = 2;  h[33] = 0;
+  h[34] = 16; h[35] = 0;
+  memcpy (&h[36], "data", 4);
+  h[40] = (U8)data;         h[41] = (U8)(data >> 8);
+  h[42] = (U8)(data >> 16); h[43] = (U8)(data >> 24);
+  if (pwrite (wav_fd, h, sizeof (h), 0) != sizeof (h)) {
+    return;
+  }
+}
+
+static void wav_flush (void) {
+  if (wav_fd >= 0 && wav_cnt) {
+    if (write (wav_fd, wav_buf, wav_cnt * 2) < 0) {
+      wav_fd = -1;
+    }
+  }
+  wav_cnt = 0;
+}
+
+static void dac_capture (void) {
+  U32 rate;
+
+  if (wav_fd < 0) {
+    return;
+  }
+  if (wav_rate == 0) {
+    rate     = R(T0MR0) + 1;
+    wav_rate = (SIM_PCLK + rate / 2) / rate;
+  }
+  /* DACR VALUE field is bits 15:6, offset binary. */
+  wav_buf[wav_cnt++] = (S16)((((R(DACR) >> 6) & 0x3FF) << 6) - 0x8000);
+  wav_samples++;
+  if (wav_cnt == sizeof (wav_buf) / sizeof (wav_buf[0])) {
+    wav_flush ();
+  }
+}
+
+/*----------------------------------------------------------------------------
+ *        Interrupt dispatch
+ *---------------------------------------------------------------------------*/
+static void vic_call (U32 ch) {
+  void (*isr)(void);
+
+  isr = (void (*)(void))(uintptr_t)reg[SIM_VICVectAddr0 + ch];
+  if (isr != NULL) {
+    isr ();
+  }
+  sim_commit ();
+}
+
+static void sim_irq (void) {
+  U32 raw, pend, ch, best, k;
+
+  for (k = 0; k < 32; k++) {
+    raw = vic_soft;
+    if (adc_raw) {
+      raw |= (1 << VIC_ADC0);
+    }
+    if (R(IO2_INT_STAT_F) & R(IO2_INT_EN_F)) {
+      raw |= (1 << VIC_EINT3);
+    }
+    if (R(MCI_STATUS) & R(MCI_MASK0)) {
+      raw |= (1 << VIC_MCI);
+    }
+    if (R(GPDMA_INT_STAT)) {
+      raw |= (1 << VIC_GPDMA);
+    }
+    if (uart_iir (sim_now ()) != 0x01) {
+      raw |= (1 << VIC_UART1);
+    }
+    pend = raw & vic_enable & ~R(VICIntSelect) & ~(1 << VIC_TIMER0);
+    if (pend == 0) {
+      return;
+    }
+    /* Lowest VectCntl value has the highest priority. */
+    best = 32;
+    for (ch = 0; ch < 32; ch++) {
+      if ((pend & (1 << ch)) && (best == 32 ||
+          (reg[SIM_VICVectCntl0 + ch] & 0xF) < (reg[SIM_VICVectCntl0 + best] & 0xF))) {
+        best = ch;
+      }
+    }
+    vic_call (best);
+    if (best == VIC_ADC0) {
+      adc_raw = 0;
+    }
+  }
+}
+
+/*----------------------------------------------------------------------------
+ *        Host tick: advance the virtual clock and raise interrupts
+ *---------------------------------------------------------------------------*/
+static void sim_tick (int sig) {
+  U64 now, period;
+  U32 i, n;
+
+  (void)sig;
+  if (lock) {
+    /* Foreground is inside a register commit, catch up next tick. */
+    tick_skip++;
+    return;
+  }
+  in_isr = 1;
+  sim_commit ();
+  now = sim_now ();
+
+  /* Buttons: press pulls the pin low, release 50 ms later. */
+  for (i = 0; i < btn_cnt; i++) {
+    if (btn[i].state == 0 && now >= btn[i].at) {
+      R(FIO2PIN)        &= ~btn[i].mask;
+      R(IO2_INT_STAT_F) |= btn[i].mask & R(IO2_INT_EN_F);
+      btn[i].state = 1;
+    }
+    else if (btn[i].state == 1 && now >= btn[i].at + btn[i].hold) {
+      R(FIO2PIN)        |= btn[i].mask;
+      btn[i].state = 2;
+    }
+  }
+
+  /* Timer0 match events since the last tick, at most 100 ms worth. */
+  n = 0;
+  while (t_run[0] && t0_next <= now) {
+    period   = (U64)R(T0MR0) + 1;
+    t0_next += period;
+    if (++n > SIM_PCLK / 10 / period) {
+      t0_next = now + period;
+      break;
+    }
+    if (vic_enable & (1 << VIC_TIMER0)) {
+      if (R(VICIntSelect) & (1 << VIC_TIMER0)) {
+        FIQ_Handler ();
+        sim_commit ();
+      }
+      else {
+        vic_call (VIC_TIMER0);
+      }
+      t0_events++;
+      dac_capture ();
+    }
+    sim_irq ();
+  }
+  sim_irq ();
+  ticks_done++;
+  in_isr = 0;
+
+  if (sim_cfg.limit > 0 && now >= (U64)(sim_cfg.limit * SIM_PCLK)) {
+    stop = 1;
+  }
+}
+
+/*----------------------------------------------------------------------------
+ *        Open the disk image behind the simulated card
+ *---------------------------------------------------------------------------*/
+BOOL sim_card_open (const char *image) {
+  off_t sz;
+
+  card.fd = open (image, O_RDWR);
+  if (card.fd < 0) {
+    fprintf (stderr, "[sim] cannot open card image %s\n", image);
+    return (__FALSE);
+  }
+  sz = lseek (card.fd, 0, SEEK_END);
+  card.size  = (sz > 0) ? (U64)sz : 0;
+  card.state = CARD_IDLE;
+  return (__TRUE);
+}
+
+/*----------------------------------------------------------------------------
+ *        Schedule a button press at virtual time 'sec', held for 'hold'
+ *        seconds
+ *---------------------------------------------------------------------------*/
+void sim_button (double sec, double hold, U32 mask) {
+  if (btn_cnt < SIM_MAX_BTN) {
+    btn[btn_cnt].at    = (U64)(sec * SIM_PCLK);
+    btn[btn_cnt].hold  = (U64)(hold * SIM_PCLK);
+    btn[btn_cnt].mask  = mask;
+    btn[btn_cnt].state = 0;
+    btn_cnt++;
+  }
+}
+
+/*----------------------------------------------------------------------------
+ *        Set up memory, registers and capture before the firmware runs
+ *---------------------------------------------------------------------------*/
+void sim_init (void) {
+  void *p;
+
+  p = mmap ((void *)(uintptr_t)SIM_AHB_BASE, SIM_AHB_SIZE,
+            PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE,
+            -1, 0);
+  if (p != (void *)(uintptr_t)SIM_AHB_BASE) {
+    fprintf (stderr, "[sim] cannot map AHB RAM at 0x%08X\n", SIM_AHB_BASE);
+    exit (2);
+  }
+
+  /* Reset values, PCLKSEL as LPC2300.s sets them */
+  R(PCLKSEL1) = 0x01000000;
+  R(FIO2PIN)  = SIM_BTN_PLAY | SIM_BTN_STOP | SIM_BTN_BACK | SIM_BTN_FORW;
+  R(U1LSR)   = 0x60;
+  R(U1DLL)   = 1;
+  R(U1THR)   = UART_NO_WRITE;
+  sim_console ();
+
+  if (sim_cfg.image != NULL) {
+    sim_card_open (sim_cfg.image);
+  }
+  if (sim_cfg.wav != NULL) {
+    wav_fd = open (sim_cfg.wav, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (wav_fd < 0) {
+      fprintf (stderr, "[sim] cannot create %s\n", sim_cfg.wav);
+    }
+    else if (lseek (wav_fd, 44, SEEK_SET) != 44) {
+      wav_fd = -1;
+    }
+  }
+}
+
+/*----------------------------------------------------------------------------
+ *        Start the virtual clock
+ *---------------------------------------------------------------------------*/
+void sim_start (void) {
+  struct sigaction sa;
+  struct itimerval it;
+
+  clock_gettime (CLOCK_MONOTONIC, &host_t0);
+
+  memset (&sa, 0, sizeof (sa));
+  sa.sa_handler = sim_tick;
+  sa.sa_flags   = SA_RESTART;
+  sigemptyset (&sa.sa_mask);
+  sigaction (SIGALRM, &sa, NULL);
+
+  it.it_interval.tv_sec  = 0;
+  it.it_interval.tv_usec = SIM_TICK_US;
+  it.it_value            = it.it_interval;
+  setitimer (ITIMER_REAL, &it, NULL);
+}
+
+/*----------------------------------------------------------------------------
+ *        Stop the clock, finish the capture and leave
+ *---------------------------------------------------------------------------*/
+void sim_exit (int code) {
+  struct itimerval it;
+
+  memset (&it, 0, sizeof (it));
+  setitimer (ITIMER_REAL, &it, NULL);
+  fflush (stdout);
+
+  if (wav_fd >= 0) {
+    wav_flush ();
+    wav_header (wav_rate ? wav_rate : 8000, wav_samples);
+    close (wav_fd);
+  }
+  fprintf (stderr, "[sim] %.3f s virtual, %llu ticks (%u deferred), "
+           "%llu Timer0 events, %llu samples captured\n",
+           (double)sim_now () / SIM_PCLK, ticks_done, tick_skip,
+           t0_events, wav_samples);
+  exit (code);
+}
+
+/*----------------------------------------------------------------------------
+ *        UART1 model: one character time in PCLK ticks, 8N1, 0 = off
+ *---------------------------------------------------------------------------*/
+static U64 uart_char (void) {
+  U32 div, mul, add;
+
+  div = (R(U1DLM) & 0xFF) * 256 + (R(U1DLL) & 0xFF);
+  mul = (R(U1FDR) >> 4) & 0x0F;
+  add = R(U1FDR) & 0x0F;
+  if (div == 0) {
+    return (0);
+  }
+  if (mul == 0) {
+    mul = 1;
+    add = 0;
+  }
+  return ((U64)10 * 16 * div * (mul + add) / mul);
+}
+
+/*----------------------------------------------------------------------------
+ *        UART1 model: the next character from stdin, -1 when none waits
+ *---------------------------------------------------------------------------*/
+static int uart_input (void) {
+  struct pollfd pfd;
+  ssize_t n;
+
+  if (uart.in_pos == uart.in_len) {
+    pfd.fd     = 0;
+    pfd.events = POLLIN;
+    if (uart.eof || poll (&pfd, 1, 0) != 1) {
+      return (-1);
+    }
+    n = read (0, uart.in, sizeof (uart.in));
+    if (n <= 0) {
+      uart.eof = 1;
+      return (-1);
+    }
+    uart.in_pos = 0;
+    uart.in_len = (U32)n;
+  }
+  return (uart.in[uart.in_pos++]);
+}
+
+/*----------------------------------------------------------------------------
+ *        UART1 model: move the characters due by 'now' on both lines.
+ *        A terminal sends CR for Enter and shows CR LF as a line break.
+ *---------------------------------------------------------------------------*/
+static void uart_update (U64 now) {
+  U64 ct = uart_char ();
+  int ch;
+  char out;
+
+  if (ct == 0) {
+    return;
+  }
+  while (uart.tx_cnt && uart.tx_next + ct <= now) {
+    out = (char)uart.tx[uart.tx_out];
+    uart.tx_out = (uart.tx_out + 1) % UART_FIFO;
+    uart.tx_next += ct;
+    if (--uart.tx_cnt == 0) {
+      uart.thre = 1;
+    }
+    if (uart.cr && out != '\n' && write (1, "\r", 1) != 1) {
+      break;
+    }
+    uart.cr = (out == '\r');
+    if (!uart.cr && write (1, &out, 1) != 1) {
+      break;
+    }
+  }
+
+  /* The sender waits while the host stalls the simulation, and a full
+     FIFO waits for the receive interrupt that the chip would have taken
+     in time. Characters are lost only when the firmware falls behind.  */
+  if (uart.rx_next + 2 * (SIM_PCLK / 1000000 * SIM_TICK_US) < now) {
+    uart.rx_next = now;
+  }
+  while (uart.rx_next + ct <= now) {
+    if (uart.rx_cnt == UART_FIFO && (R(U1IER) & 0x01) &&
+        (vic_enable & (1 << VIC_UART1))) {
+      uart.rx_next = now;
+      break;
+    }
+    uart.rx_next += ct;
+    if ((ch = uart_input ()) < 0) {
+      uart.rx_next = now;
+      break;
+    }
+    if (uart.rx_cnt < UART_FIFO) {
+      ch = (ch == '\n') ? 0x0D : ch;
+      uart.rx[(uart.rx_out + uart.rx_cnt) % UART_FIFO] = (U8)ch;
+      uart.rx_cnt++;
+    }
+    else {
+      uart.oe = 1;
+    }
+    uart.rx_last = uart.rx_next;
+  }
+}
+
+/*----------------------------------------------------------------------------
+ *        UART1 model: U1IIR interrupt identification, 0x01 = none
+ *---------------------------------------------------------------------------*/
+static U32 uart_iir (U64 now) {
+  static const U8 trig[4] = { 1, 4, 8, 14 };
+  U32 ier = R(U1IER);
+
+  if ((ier & 0x04) && uart.oe) {
+    return (0x06);                      /* line status                       */
+  }
+  if ((ier & 0x01) && uart.rx_cnt >= trig[(R(U1FCR) >> 6) & 3]) {
+    return (0x04);                      /* RX data at the trigger level      */
+  }
+  if ((ier & 0x01) && uart.rx_cnt && now >= uart.rx_last + 4 * uart_char ()) {
+    return (0x0C);                      /* RX character timeout              */
+  }
+  if ((ier & 0x02) && uart.thre) {
+    return (0x02);                      /* THRE                              */
+  }
+  return (0x01);
+}
+
+/*----------------------------------------------------------------------------
+ *        UART1 model: all output sent, no THRE interrupt outstanding
+ *---------------------------------------------------------------------------*/
+static BOOL uart_idle (void) {
+  return (uart.tx_cnt == 0 && !(uart.thre && (R(U1IER) & 0x02)));
+}
+
+/*----------------------------------------------------------------------------
+ *        Wait for input: a register access runs the models and interrupts.
+ *        'done' tells that stdin was used up before the ring was looked
+ *        at, the run ends then once the output is sent.
+ *---------------------------------------------------------------------------*/
+static void uart_wait (BOOL done) {
+  if (done) {
+    while (!uart_idle ()) {
+      (void)U1SCR;
+    }
+    sim_exit (0);
+  }
+  (void)U1SCR;
+}
+
+/* getkey() and ser_rx_get() of SERIAL.C spin on the ring alone, these
+   wrappers add the end of input.                                      */
+int getkey (void) {
+  BOOL done;
+  U32 n;
+
+  for (;;) {
+    done = uart.eof && uart.rx_cnt == 0;
+    ser_rx_peek (&n);
+    if (n != 0) {
+      return (ser_getkey ());
+    }
+    uart_wait (done);
+  }
+}
+
+U8 *ser_rx_get (U32 *len) {
+  static U8 *last_p;
+  static U32 last_n;
+  BOOL done;
+  U8 *p;
+
+  done = uart.eof && uart.rx_cnt == 0;
+  p = ser_rx_peek (len);
+  if (p == last_p && *len == last_n) {
+    uart_wait (done);                   /* nothing new since the last call   */
+  }
+  last_p = p;
+  last_n = *len;
+  return (p);
+}
+
+/*----------------------------------------------------------------------------
+ *        Firmware stdout, sent by SERIAL.C like Retarget.c does on the chip
+ *---------------------------------------------------------------------------*/
+static ssize_t con_write (void *cookie, const char *buf, size_t n) {
+  size_t i;
+
+  (void)cookie;
+  for (i = 0; i < n; i++) {
+    sendchar ((U8)buf[i]);
+  }
+  return ((ssize_t)n);
+}
+
+static void sim_console (void) {
+  static cookie_io_functions_t io = { NULL, con_write, NULL, NULL };
+  FILE *f;
+
+  f = fopencookie (NULL, "w", io);
+  if (f != NULL) {
+    setvbuf (f, NULL, _IONBF, 0);
+    stdout = f;
+  }
+}
+
+/*----------------------------------------------------------------------------
+ *        Text LCD on stderr
+ *---------------------------------------------------------------------------*/
+static char lcd_text[2][17];
+static U32  lcd_pos;
+
+static void lcd_show (void) {
+  char line[48];
+  int n;
+
+  /* Called from interrupt handlers, keep to async-signal-safe calls. */
+  n = 0;
+  memcpy (&line[n], "[LCD] ", 6);         n += 6;
+  memcpy (&line[n], lcd_text[0], strlen (lcd_text[0]));
+  n += (int)strlen (lcd_text[0]);
+  line[n++] = '\n';
+  if (write (2, line, n) < 0) {
+    return;
+  }
+}
+
+void lcd_init (void) {
+  memset (lcd_text, 0, sizeof (lcd_text));
+}
+
+void lcd_clear (void) {
+  memset (lcd_text, 0, sizeof (lcd_text));
+  lcd_pos = 0;
+}
+
+void set_cursor (unsigned char column, unsigned char line) {
+  lcd_pos = (line & 1) * 16 + (column & 15);
+}
+
+void lcd_putchar (char c) {
+  if (lcd_pos < 32) {
+    lcd_text[lcd_pos / 16][lcd_pos % 16] = c;
+    lcd_pos++;
+  }
+}
+
+void lcd_print (unsigned char const *string) {
+  while (*string) {
+    lcd_putchar (*string++);
+  }
+  lcd_show ();
+}
+
+/*----------------------------------------------------------------------------
+ * end of file
+ *---------------------------------------------------------------------------*/
@@ -0,0 +1,110 @@
+/*----------------------------------------------------------------------------
+ *      Host Simulation
+ *----------------------------------------------------------------------------
+ *      Name:    SIM_MAIN.C
+ *      Purpose: Command line front end of the host simulation build
+ *---------------------------------------------------------------------------*/
+
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <RTL.h>
+#include "Sim.h"
+
+static const char usage[] =
+  "usage: sd_sim [options] < commands\n"
+  "  -d dir         card directory seen by the file system (default .)\n"
+  "  -i image       disk image behind mci0_drv\n"
+  "  -o file.wav    capture DAC output\n"
+  "  -x factor      virtual clock speed factor (default 1.0)\n"
+  "  -t seconds     stop after this much virtual time\n"
+  "  -v level       volume potentiometer, A/D value 0..1023 (default 512)\n"
+  "  -b sec:BUTTON[:hold]\n"
+  "                 press PLAY, STOP, FORW or BACK at virtual time sec,\n"
+  "                 for hold seconds (default 0.05)\n"
+  "Console commands are read from stdin, end of input ends the run.\n";
+
+/*----------------------------------------------------------------------------
+ *        Parse a button event "sec:NAME[:hold]"
+ *---------------------------------------------------------------------------*/
+static BOOL parse_button (char *arg) {
+  char *sp = strchr (arg, ':');
+  char *hp;
+  double sec, hold = 0.05;
+
+  if (sp == NULL) {
+    return (__FALSE);
+  }
+  *sp++ = 0;
+  sec   = atof (arg);
+  if ((hp = strchr (sp, ':')) != NULL) {
+    *hp++ = 0;
+    hold  = atof (hp);
+  }
+  if      (strcasecmp (sp, "PLAY") == 0) sim_button (sec, hold, SIM_BTN_PLAY);
+  else if (strcasecmp (sp, "STOP") == 0) sim_button (sec, hold, SIM_BTN_STOP);
+  else if (strcasecmp (sp, "FORW") == 0) sim_button (sec, hold, SIM_BTN_FORW);
+  else if (strcasecmp (sp, "BACK") == 0) sim_button (sec, hold, SIM_BTN_BACK);
+  else return (__FALSE);
+  return (__TRUE);
+}
+
+/*----------------------------------------------------------------------------
+ *        Main
+ *---------------------------------------------------------------------------*/
+int main (int argc, char *argv[]) {
+  int opt;
+
+  while ((opt = getopt (argc, argv, "d:i:o:x:t:v:b:h")) != -1) {
+    switch (opt) {
+      case 'd': sim_cfg.card  = optarg;                 break;
+      case 'i': sim_cfg.image = optarg;                 break;
+      case 'o': sim_cfg.wav   = optarg;                 break;
+      case 'x': sim_cfg.speed = atof (optarg);          break;
+      case 't': sim_cfg.limit = atof (optarg);          break;
+      case 'v': sim_cfg.adc   = (U32)atoi (optarg);     break;
+      case 'b':
+        if (!parse_button (optarg)) {
+          fprintf (stderr, "bad button event\n%s", usage);
+          return (2);
+        }
+        break;
+      default:
+        fprintf (stderr, "%s", usage);
+        return (2);
+    }
+  }
+  if (sim_cfg.speed <= 0) {
+    sim_cfg.speed = 1.0;
+  }
+
+  /* Paths given on the command line are relative to the caller. */
+  if (sim_cfg.image && sim_cfg.image[0] != '/') {
+    sim_cfg.image = realpath (sim_cfg.image, NULL);
+  }
+  if (sim_cfg.wav && sim_cfg.wav[0] != '/') {
+    static char path[4096];
+    if (getcwd (path, sizeof (path) - 2 - strlen (sim_cfg.wav)) != NULL) {
+      strcat (path, "/");
+      strcat (path, sim_cfg.wav);
+      sim_cfg.wav = path;
+    }
+  }
+  if (chdir (sim_cfg.card) != 0) {
+    fprintf (stderr, "cannot enter card directory %s\n", sim_cfg.card);
+    return (2);
+  }
+
+  sim_init ();
+  sim_start ();
+  sd_main ();
+  sim_exit (0);
+  return (0);
+}
+
+/*----------------------------------------------------------------------------
+ * end of file
+ *---------------------------------------------------------------------------*/
@@ -0,0 +1,193 @@
+/*----------------------------------------------------------------------------
+ *      Host Simulation
+ *----------------------------------------------------------------------------
+ *      Name:    TEST_CVT.C
+ *      Purpose: Check the PCM to DAC word kernels at every source alignment
+ *----------------------------------------------------------------------------
+ *      AUDIO.C is included, so that the static kernels can be called. On
+ *      x86 the alignment check flag is set around each kernel call: a word
+ *      load from an unaligned source, which the ARM7 would rotate, stops
+ *      the test with SIGBUS instead of passing unnoticed.
+ *---------------------------------------------------------------------------*/
+
+#include "../Audio.c"
+#include <stdlib.h>
+
+#define TEST_FRAMES     64              /* Frames per kernel call, at most   */
+
+static volatile unsigned int test_regs[SIM_REG_CNT];
+static U32 test_ring[AUD_SEG_CNT * AUD_SEG_WORDS];
+static U32 test_fails;
+
+/*----------------------------------------------------------------------------
+ *        Register file for AUDIO.C, no peripheral behind it
+ *---------------------------------------------------------------------------*/
+volatile unsigned int *sim_reg (int id) {
+  return (&test_regs[id]);
+}
+
+/*----------------------------------------------------------------------------
+ *        Trap unaligned loads from here on (x86 only)
+ *---------------------------------------------------------------------------*/
+static void test_ac (BOOL on) {
+#if defined(__x86_64__)
+  if (on) {
+    __asm__ volatile ("pushfq; orq $0x40000, (%rsp); popfq");
+  } else {
+    __asm__ volatile ("pushfq; andq $~0x40000, (%rsp); popfq");
+  }
+#else
+  (void)on;
+#endif
+}
+
+/*----------------------------------------------------------------------------
+ *        DAC word the reference formula gives for the frame at 'bp'
+ *---------------------------------------------------------------------------*/
+static U32 test_ref (U32 md, const U8 *bp, U32 sh) {
+  switch (md) {
+    case 0:  return (SMP_MONO8 (bp) >> sh);
+    case 1:  return (SMP_STEREO8 (bp) >> sh);
+    case 2:  return (SMP_MONO16 (bp) >> sh);
+    default: return (SMP_STEREO16 (bp) >> sh);
+  }
+}
+
+/*----------------------------------------------------------------------------
+ *        Compare 'cnt' words at 'dst' with the frames at 'pcm'
+ *---------------------------------------------------------------------------*/
+static void test_check (const char *what, U32 md, U32 off, const U32 *dst,
+                        const U8 *pcm, U32 cnt, U32 sh) {
+  U32 frame = ((md & 1) + 1) << ((md >> 1) & 1);
+  U32 i, ref;
+
+  for (i = 0; i < cnt; i++) {
+    ref = test_ref (md, pcm + i * frame, sh);
+    if (dst[i] != ref) {
+      printf ("%s: format %d, offset %d, word %d of %d: %04X, expected %04X\n",
+              what, md, off, i, cnt, dst[i], ref);
+      test_fails++;
+      return;
+    }
+  }
+}
+
+/*----------------------------------------------------------------------------
+ *        Each kernel from every byte offset, for every frame count
+ *---------------------------------------------------------------------------*/
+static void test_kernels (void) {
+  static U32 src[TEST_FRAMES + 2], dst[TEST_FRAMES];
+  U8 *pcm = (U8 *)src;
+  U32 md, off, cnt, i;
+
+  for (i = 0; i < sizeof (src); i++) {
+    pcm[i] = (U8)rand ();
+  }
+  for (md = 0; md < 4; md++) {
+    for (off = 0; off < 4; off++) {
+      for (cnt = 0; cnt <= TEST_FRAMES; cnt++) {
+        memset (dst, 0xAA, sizeof (dst));
+        test_ac (__TRUE);
+        aud_cvt_tab[md] (dst, pcm + off, cnt, 3);
+        test_ac (__FALSE);
+        test_check ("kernel", md, off, dst, pcm + off, cnt, 3);
+      }
+    }
+  }
+}
+
+/*----------------------------------------------------------------------------
+ *        A seek to any frame of a file in a DMA buffer, converted with
+ *        aud_ring_cvt() the way play_fill() does for raw card reads
+ *---------------------------------------------------------------------------*/
+static void test_seek (void) {
+  static U32 buf[AUD_SEG_WORDS + 1];
+  U8 *pcm = (U8 *)buf;
+  U32 md, frame, tgt, n, i;
+
+  for (i = 0; i < sizeof (buf); i++) {
+    pcm[i] = (U8)rand ();
+  }
+  for (md = 0; md < 4; md++) {
+    frame = ((md & 1) + 1) << ((md >> 1) & 1);
+    for (tgt = 0; tgt < 4; tgt++) {
+      curAudio.md  = (char)md;
+      curAudio.vol = 7;
+      aud_ring_reset ();
+      n = (AUD_SEG_WORDS - 4) * frame;
+      test_ac (__TRUE);
+      aud_ring_cvt (pcm + tgt * frame, n);
+      test_ac (__FALSE);
+      test_check ("seek", md, tgt * frame, test_ring, pcm + tgt * frame,
+                  n / frame, 0);
+    }
+  }
+}
+
+/*----------------------------------------------------------------------------
+ *        Files of every format back to back, each read into the ring in
+ *        place through aud_ring_get(), starting where the last one ended
+ *---------------------------------------------------------------------------*/
+static void test_gapless (void) {
+  static const U32 cnt[] = { 3, 1, 7, 2, 5, 254 };
+  static U8 pcm[4 * 8 * AUD_SEG_WORDS];
+  static U32 ref[AUD_SEG_CNT * AUD_SEG_WORDS];
+  U32 md, frame, i, k, n, words, room, pos = 0;
+  U8 *bp;
+
+  for (i = 0; i < sizeof (pcm); i++) {
+    pcm[i] = (U8)rand ();
+  }
+  curAudio.md  = 0;
+  curAudio.vol = 7;
+  aud_ring_reset ();
+  for (words = 0, i = 0; i < 4 * sizeof (cnt) / sizeof (cnt[0]); i++) {
+    md = i % 4;
+    if (md != (U32)curAudio.md) {
+      curAudio.md = (char)md;
+      aud_ring_next ();
+    }
+    frame = ((md & 1) + 1) << ((md >> 1) & 1);
+    bp = aud_ring_get (&room);
+    if (bp == NULL) {
+      break;
+    }
+    n = cnt[i / 4] * frame;
+    n = (n > room) ? room : n;
+    memcpy (bp, &pcm[pos], n);
+    for (k = 0; k < n / frame; k++) {
+      ref[words++] = test_ref (md, &pcm[pos + k * frame], 0);
+    }
+    test_ac (__TRUE);
+    aud_ring_put (n);
+    test_ac (__FALSE);
+    pos += n;
+  }
+  aud_ring_flush ();
+  for (i = 0; i < words; i++) {
+    if (test_ring[i] != ref[i]) {
+      printf ("gapless: word %d of %d: %04X, expected %04X\n",
+              i, words, test_ring[i], ref[i]);
+      test_fails++;
+      break;
+    }
+  }
+}
+
+/*----------------------------------------------------------------------------
+ *        Main
+ *---------------------------------------------------------------------------*/
+int main (void) {
+
+  curAudio.ring.seg = test_ring;
+  srand (1);
+  test_kernels ();
+  test_seek ();
+  test_gapless ();
+  printf ("test_cvt: %s\n", test_fails ? "FAILED" : "passed");
+  return (test_fails ? 1 : 0);
+}
+
+/*----------------------------------------------------------------------------
+ * end of file
+ *---------------------------------------------------------------------------*/
@@ -0,0 +1,138 @@
+/*----------------------------------------------------------------------------
+ *      Host Simulation
+ *----------------------------------------------------------------------------
+ *      Name:    FILE_CONFIG.H
+ *      Purpose: RL-FlashFS interface for the host simulation build
+ *---------------------------------------------------------------------------*/
+
+#ifndef __FILE_CONFIG_H__
+#define __FILE_CONFIG_H__
+
+#include <stdio.h>
+#include <RTL.h>
+
+/* File attributes */
+#define ATTR_READ_ONLY     0x01
+#define ATTR_HIDDEN        0x02
+#define ATTR_SYSTEM        0x04
+#define ATTR_VOLUME_ID     0x08
+#define ATTR_DIRECTORY     0x10
+#define ATTR_ARCHIVE       0x20
+
+typedef struct {
+  U8  hr;
+  U8  min;
+  U8  sec;
+  U8  day;
+  U8  mon;
+  U16 year;
+} RL_TIME;
+
+typedef struct {
+  S8      name[256];
+  U32     size;
+  U16     fileID;
+  U8      attrib;
+  RL_TIME time;
+} FINFO;
+
+/* SD/MMC commands */
+#define GO_IDLE_STATE      0
+#define SEND_OP_COND       1
+#define ALL_SEND_CID       2
+#define SET_RELATIVE_ADDR  3
+#define SET_ACMD_BUS_WIDTH 6
+#define SELECT_CARD        7
+#define SEND_IF_COND       8
+#define SEND_CSD           9
+#define SEND_CID           10
+#define STOP_TRANS         12
+#define SEND_STATUS        13
+#define SET_BLOCK_LEN      16
+#define READ_BLOCK         17
+#define READ_MULT_BLOCK    18
+#define WRITE_BLOCK        24
+#define WRITE_MULT_BLOCK   25
+#define SEND_APP_OP_COND   41
+#define APP_CMD            55
+
+/* MCI bus mode, response type and DMA direction */
+#define BUS_OPEN_DRAIN     0
+#define BUS_PUSH_PULL      1
+#define RESP_NONE          0
+#define RESP_SHORT         1
+#define RESP_LONG          2
+#define DMA_READ           0
+#define DMA_WRITE          1
+
+/* Media status */
+#define M_INSERTED         0x01
+#define M_PROTECTED        0x02
+
+typedef struct {
+  U32 block_cnt;
+  U16 read_blen;
+  U16 write_blen;
+} Media_INFO;
+
+/* MCI Device Driver */
+typedef struct {
+  BOOL (*Init)        (void);
+  BOOL (*UnInit)      (void);
+  void (*Delay)       (U32 us);
+  BOOL (*BusMode)     (U32 mode);
+  BOOL (*BusWidth)    (U32 width);
+  BOOL (*BusSpeed)    (U32 kbaud);
+  BOOL (*Command)     (U8 cmd, U32 arg, U32 resp_type, U32 *rp);
+  BOOL (*ReadBlock)   (U32 bl, U8 *buf, U32 cnt);
+  BOOL (*WriteBlock)  (U32 bl, U8 *buf, U32 cnt);
+  BOOL (*SetDma)      (U32 mode, U8 *buf, U32 cnt);
+  U32  (*CheckMedia)  (void);
+} const MCI_DRV;
+
+typedef struct {
+  MCI_DRV *drv;
+  U32      rca;
+  U8       sdhc;
+  U8       status;
+  U32      block_cnt;
+} MCI_DEV;
+
+/* FAT Sector Driver */
+typedef struct {
+  BOOL (*Init)        (U32 mode);
+  BOOL (*UnInit)      (U32 mode);
+  BOOL (*ReadSect)    (U32 sect, U8 *buf, U32 cnt);
+  BOOL (*WriteSect)   (U32 sect, U8 *buf, U32 cnt);
+  BOOL (*ReadInfo)    (Media_INFO *cfg);
+  U32  (*DevCtrl)     (U32 code, void *p);
+} const FAT_DRV;
+
+extern MCI_DRV mci0_drv;
+extern FAT_DRV mc0_drv;
+
+/* MCI layer */
+extern BOOL mci_Init        (U32 mode, MCI_DEV *mci);
+extern BOOL mci_UnInit      (U32 mode, MCI_DEV *mci);
+extern BOOL mci_ReadSector  (U32 sect, U8 *buf, U32 cnt, MCI_DEV *mci);
+extern BOOL mci_WriteSector (U32 sect, U8 *buf, U32 cnt, MCI_DEV *mci);
+extern BOOL mci_ReadInfo    (Media_INFO *info, MCI_DEV *mci);
+
+/* File System API */
+extern int finit    (const char *drive);
+extern int funinit  (const char *drive);
+extern int fdelete  (const char *filename);
+extern int frename  (const char *oldname, const char *newname);
+extern int ffind    (const char *pattern, FINFO *info);
+extern U64 ffree    (const char *drive);
+extern int fformat  (const char *drive);
+
+/* Card file names are case-insensitive */
+extern FILE *sim_fopen (const char *name, const char *mode);
+#define fopen   sim_fopen
+
+#endif
+
+/*----------------------------------------------------------------------------
+ * end of file
+ *---------------------------------------------------------------------------*/
@@ -0,0 +1,39 @@
+/*----------------------------------------------------------------------------
+ *      Host Simulation
+ *----------------------------------------------------------------------------
+ *      Name:    RTL.H
+ *      Purpose: RL-ARM type definitions for the host simulation build
+ *---------------------------------------------------------------------------*/
+
+#ifndef __RTL_H__
+#define __RTL_H__
+
+typedef signed char     S8;
+typedef unsigned char   U8;
+typedef short           S16;
+typedef unsigned short  U16;
+typedef int             S32;
+typedef unsigned int    U32;
+typedef long long       S64;
+typedef unsigned long long U64;
+typedef unsigned char   BIT;
+typedef unsigned int    BOOL;
+
+#ifndef __TRUE
+ #define __TRUE         1
+#endif
+#ifndef __FALSE
+ #define __FALSE        0
+#endif
+
+/* ARM compiler keywords. Interrupt handlers are plain functions called by
+   the simulated VIC, 'at' placement is done with fixed address mappings. */
+#define __irq
+#define __inline        inline
+#define __packed
+
+#endif
+
+/*----------------------------------------------------------------------------
+ * end of file
+ *---------------------------------------------------------------------------*/
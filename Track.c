@@ -0,0 +1,204 @@
+/*----------------------------------------------------------------------------
+ *      Name:    TRACK.C
+ *      Purpose: On-card track index
+ *----------------------------------------------------------------------------
+ *      TRACKS.IDX keeps the parsed wave header of every track, so that a
+ *      playlist starts without opening each file. Before use the index is
+ *      checked against a quiet walk over the directory snapshot (Dir.c),
+ *      and rebuilt when a file was added, removed or changed.
+ *---------------------------------------------------------------------------*/
+
+#include <RTL.h>                      /* RTL kernel functions & defines      */
+#include <stdio.h>                    /* standard I/O .h-file                */
+#include <string.h>                   /* string and memory functions         */
+#include <ctype.h>                    /* character functions                 */
+#include <File_Config.h>
+#include "Audio.h"
+#include "Dir.h"
+#include "Track.h"
+
+#define TRK_FNV_INIT    2166136261u
+#define TRK_FNV_PRIME   16777619u
+
+static FILE   *trk_f;                   /* Index being read                  */
+static TRK_HDR trk_hdr;
+static U32     trk_left;                /* Records not read yet              */
+
+/* Local Function Prototypes */
+static BOOL trk_walk (const char *mask, U32 *files, U32 *sig);
+static void trk_set_mask (char *dst, const char *mask);
+static U32  trk_write (const char *mask, U32 files, U32 sig);
+
+/*----------------------------------------------------------------------------
+ *        Walk the files matching 'mask', count them and sign the walk.
+ *        __FALSE when none match or a name does not fit a record.
+ *---------------------------------------------------------------------------*/
+static BOOL trk_walk (const char *mask, U32 *files, U32 *sig) {
+  DIR_ENT *e;
+  const char *p;
+  U32 h = TRK_FNV_INIT;
+  U32 n = 0;
+
+  dir_open (mask, DIR_BY_DIR);
+  while ((e = dir_next ()) != NULL) {
+    if ((e->attrib & ATTR_DIRECTORY) || strcmp (e->name, TRK_FILE) == 0) {
+      continue;
+    }
+    if (e->len >= TRK_NAME_LEN) {
+      *files = TRK_NO_INDEX;
+      return (__FALSE);
+    }
+    for (p = e->name; *p; p++) {
+      h = (h ^ toupper (*p)) * TRK_FNV_PRIME;
+    }
+    h = (h ^ e->size) * TRK_FNV_PRIME;
+    h = (h ^ e->time) * TRK_FNV_PRIME;
+    n++;
+  }
+  *files = n;
+  *sig   = h;
+  return (n != 0);
+}
+
+/*----------------------------------------------------------------------------
+ *        Store a mask in upper case, the way FAT compares names
+ *---------------------------------------------------------------------------*/
+static void trk_set_mask (char *dst, const char *mask) {
+  U32 i;
+
+  for (i = 0; i < TRK_NAME_LEN - 1 && mask[i]; i++) {
+    dst[i] = toupper (mask[i]);
+  }
+  dst[i] = 0;
+}
+
+/*----------------------------------------------------------------------------
+ *        Write the index for 'mask', returns the number of records. On a
+ *        write error the index is deleted and 0 returned.
+ *---------------------------------------------------------------------------*/
+static U32 trk_write (const char *mask, U32 files, U32 sig) {
+  FILE *f, *wf;
+  DIR_ENT *e;
+  TRK_REC rec;
+  U32 cnt = 0;
+  BOOL ok = __TRUE;
+
+  f = fopen (TRK_FILE, "w");
+  if (f == NULL) {
+    return (0);
+  }
+
+  dir_open (mask, DIR_BY_DIR);
+  while (ok && (e = dir_next ()) != NULL) {
+    if ((e->attrib & ATTR_DIRECTORY) || strcmp (e->name, TRK_FILE) == 0) {
+      continue;
+    }
+    wf = fopen (e->name, "r");
+    if (wf == NULL) {
+      continue;
+    }
+    memset (&rec, 0, sizeof (rec));
+    if (aud_parse (wf, &rec.fmt) == AUD_WAV_OK && rec.fmt.rate && rec.fmt.align) {
+      strcpy (rec.name, e->name);
+      rec.size = e->size;
+      rec.time = e->time;
+      rec.msec = (U32)(((U64)rec.fmt.data_len * 1000) /
+                       ((U32)rec.fmt.rate * rec.fmt.align));
+      ok = (fwrite (&rec, sizeof (rec), 1, f) == 1);
+      cnt++;
+    }
+    fclose (wf);
+  }
+
+  /* The header goes last, it makes the records valid. */
+  memset (&trk_hdr, 0, sizeof (trk_hdr));
+  trk_hdr.magic = TRK_MAGIC;
+  trk_hdr.files = files;
+  trk_hdr.sig   = sig;
+  trk_hdr.recs  = cnt;
+  trk_set_mask (trk_hdr.mask, mask);
+  if (ok) {
+    ok = (fwrite (&trk_hdr, sizeof (trk_hdr), 1, f) == 1);
+  }
+  if (fclose (f) != 0 || !ok) {
+    fdelete (TRK_FILE);                 /* card full: no half written index  */
+    return (0);
+  }
+  return (cnt);
+}
+
+/*----------------------------------------------------------------------------
+ *        Rebuild the index for 'mask', returns the number of records
+ *---------------------------------------------------------------------------*/
+U32 trk_build (const char *mask) {
+  U32 files, sig;
+
+  trk_close ();
+  if (!trk_walk (mask, &files, &sig) && files == TRK_NO_INDEX) {
+    fdelete (TRK_FILE);
+    return (TRK_NO_INDEX);
+  }
+  return (trk_write (mask, files, sig));
+}
+
+/*----------------------------------------------------------------------------
+ *        Open the index for 'mask', rebuild it first if it is out of date
+ *        or was cut short. The records are then read from the start.
+ *---------------------------------------------------------------------------*/
+BOOL trk_open (const char *mask) {
+  char umask[TRK_NAME_LEN];
+  U32 files, sig, n;
+
+  trk_close ();
+  if (!trk_walk (mask, &files, &sig)) {
+    return (__FALSE);
+  }
+  trk_set_mask (umask, mask);
+
+  for (n = 0; n < 2; n++) {
+    trk_f = fopen (TRK_FILE, "r");
+    if (trk_f != NULL) {
+      if (fseek (trk_f, -(long)sizeof (trk_hdr), SEEK_END) == 0 &&
+          fread (&trk_hdr, sizeof (trk_hdr), 1, trk_f) == 1 &&
+          trk_hdr.magic == TRK_MAGIC && trk_hdr.files == files &&
+          trk_hdr.sig == sig && strcmp (trk_hdr.mask, umask) == 0 &&
+          ftell (trk_f) == (long)((trk_hdr.recs + 1) * sizeof (TRK_REC)) &&
+          fseek (trk_f, 0, SEEK_SET) == 0) {
+        trk_left = trk_hdr.recs;
+        return (__TRUE);
+      }
+      trk_close ();
+    }
+    if (n == 0 && trk_write (mask, files, sig) == 0) {
+      break;                            /* no playable file, or card full    */
+    }
+  }
+  return (__FALSE);
+}
+
+/*----------------------------------------------------------------------------
+ *        Read the next track record, __FALSE at the end of the index
+ *---------------------------------------------------------------------------*/
+BOOL trk_next (TRK_REC *rec) {
+
+  if (trk_f == NULL || trk_left == 0) {
+    return (__FALSE);
+  }
+  trk_left--;
+  return (fread (rec, sizeof (TRK_REC), 1, trk_f) == 1);
+}
+
+/*----------------------------------------------------------------------------
+ *        Close the index
+ *---------------------------------------------------------------------------*/
+void trk_close (void) {
+
+  if (trk_f != NULL) {
+    fclose (trk_f);
+    trk_f = NULL;
+  }
+}
+
+/*----------------------------------------------------------------------------
+ * end of file
+ *---------------------------------------------------------------------------*/
@@ -0,0 +1,48 @@
+/*----------------------------------------------------------------------------
+ *      Name:    TRACK.H
+ *      Purpose: On-card track index definitions
+ *---------------------------------------------------------------------------*/
+
+#ifndef __TRACK_H
+#define __TRACK_H
+
+#define TRK_FILE        "TRACKS.IDX"    /* Index file in the root directory  */
+#define TRK_MAGIC       0x58444957      /* "WIDX"                            */
+#define TRK_NAME_LEN    32              /* Longest name + 1 that is indexed  */
+#define TRK_NO_INDEX    0xFFFFFFFF      /* trk_build(): a name does not fit  */
+
+/* Index file: 'recs' records, then the header, one record slot in size.
+   The header is written last, an index cut short has none. The index is
+   valid while a walk over 'mask' finds 'files' files with the same
+   signature, which is taken over names, sizes and time stamps. Files that
+   are no playable wave are counted but get no record. A mask that matches
+   a name of TRK_NAME_LEN or more characters is not indexed at all, such
+   playlists come from the directory walk.                                 */
+typedef struct trk_hdr {
+  U32  magic;
+  U32  files;                           /* Files matching 'mask'             */
+  U32  sig;                             /* Signature of the directory walk   */
+  U32  recs;                            /* Records in front of the header    */
+  U32  rsv[4];
+  char mask[TRK_NAME_LEN];              /* Upper case                        */
+} TRK_HDR;
+
+/* One playable track, 64 bytes, 8 per card sector. */
+typedef struct trk_rec {
+  char    name[TRK_NAME_LEN];
+  U32     size;                         /* File size                         */
+  U32     time;                         /* Packed time stamp, FAT layout     */
+  U32     msec;                         /* Duration                          */
+  AUD_FMT fmt;                          /* Format and data chunk location    */
+} TRK_REC;
+
+extern BOOL trk_open (const char *mask);
+extern BOOL trk_next (TRK_REC *rec);
+extern void trk_close (void);
+extern U32  trk_build (const char *mask);
+
+#endif
+
+/*----------------------------------------------------------------------------
+ * end of file
+ *---------------------------------------------------------------------------*/